@@ -1,16 +1,47 @@
 #define _GNU_SOURCE
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-typedef struct { bool v, i, f; } Opt;
+#define CHUNK_MAX   (1L<<30)   // per copy_file_range()/sendfile() call
+#define MAX_THREADS 256
+#define SPLIT_CHUNK (64L<<20)  // default --chunk-size
+#define SPLIT_BUF   (1L<<20)   // pread()/pwrite() buffer of a chunk thread
+#define RING_BUFS   16         // --engine=uring: registered buffers, one read+write pair each
+#define RING_BUF    (256L<<10)
+#define RING_FILES  64         // files open in one ring before add waits for completions
+#define RW_BLOCKS   32         // read/write buffer, in st_blksize blocks
+#define RW_MAX      (4L<<20)
+#define DIRECT_BUF  (1L<<20)   // least --direct transfer, below that O_DIRECT is all latency
+#define CACHE_WIN   (8L<<20)   // --nocache: written back and dropped in windows of this size
+
+enum { SPARSE_AUTO, SPARSE_NEVER, SPARSE_ALWAYS };   // --sparse=WHEN
+typedef struct { bool v, i, f, r, uring, direct, nocache; int sparse; int threads; int chunk_threads; off_t chunk_size; } Opt;
+typedef struct { int at; const char *name, *path; } Loc;   // name is relative to the dir fd at, path is for messages
 
 static void perr(const char *fmt, ...) {
     va_list ap; fputs("cp: ", stderr);
@@ -25,65 +56,858 @@ static void perr_msg(const char *fmt, ...) {
 static inline const char* base(const char *p){ const char *s=strrchr(p,'/'); return s? s+1 : p; }
 static inline bool is_dir(const char *p){ struct stat st; return stat(p,&st)==0 && S_ISDIR(st.st_mode); }
 static inline bool same_file(const struct stat*a,const struct stat*b){ return a->st_ino==b->st_ino && a->st_dev==b->st_dev; }
+static inline bool streaming(const Opt *o){ return o->direct || o->nocache; }   // data must not go through in-kernel copies
 
 static bool ask_overwrite(const char *dst){
+    static pthread_mutex_t ask_mu=PTHREAD_MUTEX_INITIALIZER;   // workers take turns at the prompt
+    pthread_mutex_lock(&ask_mu);
     fprintf(stderr,"cp: overwrite '%s'? ",dst); fflush(stderr);
     int c=getchar(); int d; while((d=getchar())!='\n' && d!=EOF){}  // очистим строку
+    pthread_mutex_unlock(&ask_mu);
     return c=='y'||c=='Y';
 }
 
-static int copy1(const char *src, const char *dst, const Opt *o){
-    struct stat ss, ds; int dst_ok = (stat(dst,&ds)==0);
-    if (stat(src,&ss)<0){ perr("cannot stat '%s'",src); return -1; }
+// Copy tiers, fastest first. Each returns 1 when the whole file is copied, 0 when it cannot
+// handle this pair of files (the next tier takes over from the current offsets), -1 on error.
+typedef int (*TierFn)(int in, int out, off_t size);
+
+// errno values that mean "not for these files", as opposed to a real I/O error
+static inline bool unsupported(int e){ return e==EOPNOTSUPP||e==EXDEV||e==EINVAL||e==ENOSYS||e==ENOTTY; }
+
+static int try_reflink(int in, int out, off_t size){
+    (void)size;
+    if (ioctl(out,FICLONE,in)==0) return 1;
+    return unsupported(errno)? 0 : -1;
+}
+// Both loops use the file offsets, so a tier that gives up midway leaves them consistent.
+// A 0 on the very first call of a non-empty file means the kernel could not do it. Older
+// kernels also "copy" pseudo-files with st_size 0 (procfs) as empty: leave those to sendfile().
+static int try_cfr(int in, int out, off_t size){
+    if (size==0) return 0;
+    for (off_t done=0;;){
+        ssize_t n=copy_file_range(in,NULL,out,NULL,CHUNK_MAX,0);
+        if (n<0) return unsupported(errno)? 0 : -1;
+        if (n==0) return done==0 && size>0? 0 : 1;
+        done+=n;
+    }
+}
+static int try_sendfile(int in, int out, off_t size){
+    for (off_t done=0;;){
+        ssize_t n=sendfile(out,in,NULL,CHUNK_MAX);
+        if (n<0) return unsupported(errno)? 0 : -1;
+        if (n==0) return done==0 && size>0? 0 : 1;
+        done+=n;
+    }
+}
+
+static const struct { const char *name; TierFn fn; } tiers[]={
+    {"reflink",         try_reflink},
+    {"copy_file_range", try_cfr},
+    {"sendfile",        try_sendfile},
+    {"read/write",      NULL},          // copy_rw(), always works, and the only one for --direct/--nocache
+};
+
+/* --chunk-threads: one big file is cut into --chunk-size extents that several threads copy at
+ * once, each at its own offsets, so the device sees many streams instead of one. The
+ * destination is preallocated first, which also reports ENOSPC before any data moves. */
+typedef struct {
+    int in, out; off_t size, chunk;
+    atomic_llong next;            // next chunk to hand out
+    atomic_bool rw;               // copy_file_range() does not work here: pread()/pwrite()
+    atomic_int err;               // first errno, stops the others
+    atomic_llong eof;             // lowest offset a chunk found the source ending at, size if none
+    size_t zero_blk;              // --sparse=always: pread()/pwrite() leaves out all-zero blocks of this size
+} Split;
+
+static bool all_zero(const char *p, size_t n){
+    size_t i=0;
+#ifdef __SSE2__
+    for (__m128i z=_mm_setzero_si128(); i+64<=n; i+=64){
+        __m128i a=_mm_or_si128(_mm_loadu_si128((const __m128i*)(p+i)),   _mm_loadu_si128((const __m128i*)(p+i+16)));
+        __m128i b=_mm_or_si128(_mm_loadu_si128((const __m128i*)(p+i+32)),_mm_loadu_si128((const __m128i*)(p+i+48)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(a,b),z))!=0xFFFF) return false;
+    }
+#endif
+    for (; i<n; i++) if (p[i]) return false;
+    return true;
+}
+
+// pwrite()s n bytes of buf at off; with blk, runs of non-zero blocks only, the rest stays a hole
+static int put(int out, const char *buf, size_t n, off_t off, size_t blk){
+    for (size_t i=0; i<n; ){
+        size_t j=i;
+        if (blk){
+            while (i<n && all_zero(buf+i,n-i<blk? n-i : blk)) i+=n-i<blk? n-i : blk;
+            for (j=i; j<n && !all_zero(buf+j,n-j<blk? n-j : blk); ) j+=n-j<blk? n-j : blk;
+        }
+        else j=n;
+        for (; i<j; ){
+            ssize_t m=pwrite(out,buf+i,j-i,off+(off_t)i);
+            if (m<=0) return -1;
+            i+=(size_t)m;
+        }
+    }
+    return 0;
+}
+
+static int split_eof(Split *sp, off_t off){   // the source got shorter: the copy ends at off
+    long long e=atomic_load(&sp->eof);
+    while (off<e && !atomic_compare_exchange_weak(&sp->eof,&e,off)){}
+    return 0;
+}
+
+static int copy_extent(Split *sp, off_t off, off_t len, char **buf){
+    while (len>0){
+        if (!atomic_load(&sp->rw)){
+            loff_t a=off, b=off;
+            ssize_t n=copy_file_range(sp->in,&a,sp->out,&b,(size_t)len,0);
+            if (n==0) return split_eof(sp,off);
+            if (n>0){ off+=n; len-=n; continue; }
+            if (!unsupported(errno)) return -1;
+            atomic_store(&sp->rw,true);
+        }
+        if (!*buf && !(*buf=malloc(SPLIT_BUF))) return -1;
+        ssize_t n=pread(sp->in,*buf,(size_t)(len<SPLIT_BUF? len : SPLIT_BUF),off);
+        if (n==0) return split_eof(sp,off);
+        if (n<0) return -1;
+        if (put(sp->out,*buf,(size_t)n,off,sp->zero_blk)<0) return -1;
+        off+=n; len-=n;
+    }
+    return 0;
+}
+
+static void* split_worker(void *arg){
+    Split *sp=arg; char *buf=NULL;
+    for (long long i; atomic_load(&sp->err)==0 && (i=atomic_fetch_add(&sp->next,1))*sp->chunk<sp->size; ){
+        off_t off=(off_t)i*sp->chunk, len=sp->size-off<sp->chunk? sp->size-off : sp->chunk;
+        if (copy_extent(sp,off,len,&buf)<0){ int zero=0; atomic_compare_exchange_strong(&sp->err,&zero,errno? errno : EIO); }
+    }
+    free(buf);
+    return NULL;
+}
+
+// 1 when copied, 0 when the file is too small to split, -1 on error (errno set)
+static int copy_split(int in, int out, off_t size, const Opt *o, char *how, size_t howsz){
+    if (o->chunk_threads<2 || size<=o->chunk_size) return 0;
+    if (fallocate(out,0,0,size)<0){
+        if (!unsupported(errno)) return -1;
+        if (ftruncate(out,size)<0) return -1;
+    }
+    Split sp={.in=in, .out=out, .size=size, .chunk=o->chunk_size, .eof=size};
+    long long nchunks=(size+o->chunk_size-1)/o->chunk_size;
+    int nt=o->chunk_threads<nchunks? o->chunk_threads : (int)nchunks;
+
+    pthread_t tid[MAX_THREADS]; int started=1;
+    for (; started<nt; started++)
+        if (pthread_create(&tid[started],NULL,split_worker,&sp)!=0) break;
+    split_worker(&sp);
+    for (int k=1;k<started;k++) pthread_join(tid[k],NULL);
+
+    if (atomic_load(&sp.err)){ errno=atomic_load(&sp.err); return -1; }
+    if (ftruncate(out,atomic_load(&sp.eof))<0) return -1;   // the preallocated tail if the source shrank
+    snprintf(how,howsz,"%s, %d threads",atomic_load(&sp.rw)? "pread/pwrite" : "copy_file_range",started);
+    return 1;
+}
+
+/* --sparse: a file with fewer blocks than its size has holes. Only the data extents that
+ * SEEK_DATA/SEEK_HOLE report are copied; the destination was truncated on open, so what is
+ * skipped stays a hole, and the final ftruncate() recreates a trailing one. --sparse=always
+ * takes every file this way and also leaves out the all-zero blocks inside the data. */
+static inline bool holey(const struct stat *ss, const Opt *o){
+    return o->sparse==SPARSE_ALWAYS || (o->sparse==SPARSE_AUTO && (off_t)ss->st_blocks*512<ss->st_size);
+}
+
+// 1 when copied, 0 when the file has no holes or the filesystem cannot find them, -1 on error
+static int copy_sparse(int in, int out, const struct stat *ss, const Opt *o, char *how, size_t howsz){
+    if (!holey(ss,o) || ss->st_size==0) return 0;
+    struct stat ds; size_t blk=fstat(out,&ds)==0 && ds.st_blksize>0? (size_t)ds.st_blksize : 4096;
+    bool zeros=o->sparse==SPARSE_ALWAYS;
+    Split sp={.in=in, .out=out, .size=ss->st_size, .rw=zeros, .zero_blk=zeros? blk : 0, .eof=ss->st_size};
+    char *buf=NULL; off_t data_bytes=0;
+
+    for (off_t pos=0; pos<ss->st_size; ){
+        off_t data=lseek(in,pos,SEEK_DATA), hole;
+        if (data<0 && errno==ENXIO) break;   // nothing but a hole up to EOF
+        if (data<0 && pos==0 && unsupported(errno)){
+            if (!zeros) return 0;
+            data=0; hole=ss->st_size;        // no extent map: scan it all for zeros
+        }
+        else if (data<0 || (hole=lseek(in,data,SEEK_HOLE))<0){ free(buf); return -1; }
+        if (hole>ss->st_size) hole=ss->st_size;
+        if (copy_extent(&sp,data,hole-data,&buf)<0){ free(buf); return -1; }
+        data_bytes+=hole-data; pos=hole;
+    }
+    free(buf);
+    if (ftruncate(out,atomic_load(&sp.eof))<0) return -1;
+    snprintf(how,howsz,"sparse, %lld of %lld bytes data%s",(long long)data_bytes,(long long)ss->st_size,
+             zeros? ", zero blocks skipped" : "");
+    return 1;
+}
+
+/* The read/write tier streams through one heap buffer of RW_BLOCKS st_blksize blocks. --direct
+ * switches both files to O_DIRECT with the buffer aligned to the block size; a file the
+ * filesystem refuses that for stays buffered. The last block goes out padded and the file is
+ * cut back to size. --nocache stays buffered, but starts writeback of every CACHE_WIN written
+ * and, once the window before it is on disk, drops that one from the cache of both files, so a
+ * copy bigger than RAM does not evict anybody else's pages. */
+static bool set_direct(int fd, bool on){
+    int fl=fcntl(fd,F_GETFL);
+    return fl>=0 && fcntl(fd,F_SETFL,on? fl|O_DIRECT : fl&~O_DIRECT)==0;
+}
+
+static void drop_behind(int in, int out, off_t *prev, off_t *mark, off_t pos){
+    sync_file_range(out,*mark,pos-*mark,SYNC_FILE_RANGE_WRITE);
+    if (*mark>*prev){
+        sync_file_range(out,*prev,*mark-*prev,SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(out,*prev,*mark-*prev,POSIX_FADV_DONTNEED);
+        posix_fadvise(in,*prev,*mark-*prev,POSIX_FADV_DONTNEED);
+    }
+    *prev=*mark; *mark=pos;
+}
+
+static int copy_rw(int in, int out, const struct stat *ss, const char *src, const char *dst, const Opt *o, char *how, size_t howsz){
+    struct stat ds; size_t page=(size_t)sysconf(_SC_PAGESIZE);
+    size_t blk=ss->st_blksize>0? (size_t)ss->st_blksize : 4096;
+    if (fstat(out,&ds)==0 && (size_t)ds.st_blksize>blk) blk=(size_t)ds.st_blksize;
+    size_t align=blk>page && !(blk&(blk-1))? blk : page;
+    size_t bufsz=blk*RW_BLOCKS<RW_MAX? blk*RW_BLOCKS : RW_MAX;
+    if (o->direct && bufsz<DIRECT_BUF) bufsz=DIRECT_BUF;
+    bufsz=(bufsz+align-1)/align*align;
+    char *buf;
+    if (posix_memalign((void**)&buf,align,bufsz)!=0){ errno=ENOMEM; perr("error copying '%s' to '%s'",src,dst); return -1; }
+
+    bool din=o->direct && set_direct(in,true), dout=o->direct && set_direct(out,true);
+    size_t zblk=holey(ss,o)? blk : 0;   // the holes come back as zeros: leave them out again
+    off_t pos=lseek(in,0,SEEK_CUR), prev, mark; int rc=0;
+    if (pos<0) pos=0;
+    prev=mark=pos;
+    posix_fadvise(in,0,0,POSIX_FADV_SEQUENTIAL);
+    while (1){
+        ssize_t n=read(in,buf,bufsz);
+        if (n<0 && errno==EINVAL && din){ din=false; set_direct(in,false); continue; }
+        if (n==0) break;
+        if (n<0){ perr("error reading '%s'",src); rc=-1; break; }
+        size_t len=(size_t)n;
+        if (dout && len%align){ memset(buf+len,0,align-len%align); len+=align-len%align; }
+        int w=put(out,buf,len,pos,zblk);
+        if (w<0 && errno==EINVAL && dout){ dout=false; set_direct(out,false); w=put(out,buf,(size_t)n,pos,zblk); }
+        if (w<0){ perr("error writing '%s'",dst); rc=-1; break; }
+        pos+=n;
+        if (o->nocache && pos-mark>=CACHE_WIN) drop_behind(in,out,&prev,&mark,pos);
+    }
+    free(buf);
+    if (!rc && ftruncate(out,pos)<0){ perr("error writing '%s'",dst); rc=-1; }
+    if (!rc && o->nocache){
+        sync_file_range(out,prev,0,SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(out,0,0,POSIX_FADV_DONTNEED);
+        posix_fadvise(in,prev,pos-prev,POSIX_FADV_DONTNEED);   // only what this copy read
+    }
+    snprintf(how,howsz,"read/write, %zuK buffer%s%s",bufsz>>10,din||dout? ", O_DIRECT" : "",o->nocache? ", nocache" : "");
+    return rc;
+}
+
+// Picks the tier per file: the first one that works for this source and destination.
+// A file that cannot be cloned keeps its holes, or else is split over threads if it is big and
+// asked to. --sparse=always does not clone, a clone shares the zero blocks. --direct and
+// --nocache go from the clone straight to read/write. how names what was used.
+static int copy_data(int in, int out, const struct stat *ss, const char *src, const char *dst, const Opt *o, char *how, size_t howsz){
+    for (int t=0; ; t++){
+        snprintf(how,howsz,"%s",tiers[t].name);
+        if (!tiers[t].fn || (t>0 && streaming(o))) return copy_rw(in,out,ss,src,dst,o,how,howsz);
+        int r=t==0 && o->sparse==SPARSE_ALWAYS? 0 : tiers[t].fn(in,out,ss->st_size);
+        if (r==0 && t==0 && !streaming(o)){
+            r=copy_sparse(in,out,ss,o,how,howsz);
+            if (r==0) r=copy_split(in,out,ss->st_size,o,how,howsz);
+        }
+        if (r>0) return 0;
+        if (r<0){ perr("error copying '%s' to '%s'",src,dst); return -1; }
+    }
+}
+
+typedef struct Ring Ring;
+static Ring* ring_get(bool verbose);
+static int   ring_add(Ring *r, int in, int out, off_t size, const char *src, const char *dst);
+
+static int copy1(const Loc *s, const Loc *d, const Opt *o){
+    const char *src=s->path, *dst=d->path;
+    struct stat ss, ds; int dst_ok = (fstatat(d->at,d->name,&ds,0)==0);
+    if (fstatat(s->at,s->name,&ss,0)<0){ perr("cannot stat '%s'",src); return -1; }
+    if (S_ISDIR(ss.st_mode)){ perr_msg("-r not specified; omitting directory '%s'",src); return -1; }
     if (!S_ISREG(ss.st_mode)){ perr_msg("omitting non-regular file '%s'",src); return -1; }
     if (dst_ok && S_ISDIR(ds.st_mode)){ perr_msg("cannot overwrite directory '%s' with non-directory",dst); return -1; }
     if (dst_ok && same_file(&ss,&ds)){ perr_msg("'%s' and '%s' are the same file",src,dst); return -1; }
     if (dst_ok){
         if (o->i && !ask_overwrite(dst)) return 0;
-        if (o->f) unlink(dst);
+        if (o->f) unlinkat(d->at,d->name,0);
     }
-    int in = open(src,O_RDONLY);
+    int in = openat(s->at,s->name,O_RDONLY|O_CLOEXEC);
     if (in<0){ perr("cannot open '%s' for reading",src); return -1; }
-    int out = open(dst,O_WRONLY|O_CREAT|O_TRUNC, ss.st_mode & 0777);
+    int out = openat(d->at,d->name,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, ss.st_mode & 0777);
     if (out<0){ int e=errno; close(in); errno=e; perr("cannot create regular file '%s'",dst); return -1; }
 
-    char buf[131072]; int rc=0;
-    while (1){
-        ssize_t n=read(in,buf,sizeof buf);
-        if (n==0) break;
-        if (n<0){ perr("error reading '%s'",src); rc=-1; break; }
-        for (ssize_t off=0; off<n; ){
-            ssize_t m=write(out,buf+off,(size_t)(n-off));
-            if (m<=0){ perr("error writing '%s'",dst); rc=-1; break; }
-            off+=m;
-        }
-        if (rc) break;
+    // The ring takes the file over: it closes both and reports once the data is written. A file
+    // that claims to be empty (procfs), has holes to keep, or must bypass the cache is copied
+    // synchronously instead.
+    char how[64]; int rc;
+    Ring *ring=o->uring && ss.st_size>0 && !holey(&ss,o) && !streaming(o)? ring_get(o->v) : NULL;
+    if (ring){
+        int r=try_reflink(in,out,ss.st_size);
+        if (r==0) return ring_add(ring,in,out,ss.st_size,src,dst);
+        if (r<0) perr("error copying '%s' to '%s'",src,dst);
+        rc=r<0? -1 : 0; snprintf(how,sizeof how,"%s",tiers[0].name);
     }
+    else rc=copy_data(in,out,&ss,src,dst,o,how,sizeof how);
     if (close(in)!=0 || close(out)!=0) rc=-1;
-    if (!rc && o->v) printf("'%s' -> '%s'\n",src,dst);
+    if (!rc && o->v) printf("'%s' -> '%s' (%s)\n",src,dst,how);
+    return rc;
+}
+
+// Inside a tree a symlink is copied as a link, like cp -r does
+static int copy_link(const Loc *s, const Loc *d, const Opt *o){
+    char target[PATH_MAX];
+    ssize_t n=readlinkat(s->at,s->name,target,sizeof target-1);
+    if (n<0){ perr("cannot read symbolic link '%s'",s->path); return -1; }
+    target[n]=0;
+    if (symlinkat(target,d->at,d->name)<0){
+        if (errno!=EEXIST || !o->f || unlinkat(d->at,d->name,0)<0 || symlinkat(target,d->at,d->name)<0){
+            perr("cannot create symbolic link '%s'",d->path); return -1;
+        }
+    }
+    if (o->v) printf("'%s' -> '%s'\n",s->path,d->path);
+    return 0;
+}
+
+/* -r: a pool of workers copies the trees. Every worker has its own deque of tasks: it pushes
+ * and pops at the back (depth first, so few directories are open at a time) and, when it runs
+ * dry, steals from the front of another worker's deque, which holds the biggest pending
+ * subtrees. A directory task creates the destination directory before it queues a single
+ * child, so no file is ever written into a directory that does not exist yet. */
+typedef struct Dir {
+    int sfd, dfd;            // the source and destination directory, children are opened relative to them
+    char *spath, *dpath;
+    mode_t mode; bool made;  // created by us: gets its real mode once the last child is done
+    atomic_int refs;         // the walk itself plus one per queued child
+} Dir;
+
+typedef struct {
+    Dir *at;                 // NULL for a command-line operand, relative to the cwd
+    char *name, *dname;      // dname is the destination name if it differs (operands only)
+    unsigned char type;      // DT_* from readdir(), DT_UNKNOWN if not known
+} Task;
+
+typedef struct {
+    pthread_mutex_t mu;
+    Task *buf; size_t cap, head, len;   // ring buffer
+    atomic_size_t size;                 // len, readable without the lock
+} Deque;
+
+static struct {
+    const Opt *o;
+    Deque q[MAX_THREADS]; int nq;
+    atomic_size_t pending;              // queued or running tasks
+    atomic_int idle;
+    bool done;
+    pthread_mutex_t mu; pthread_cond_t cv;
+    atomic_int failed;
+} pool = {.mu=PTHREAD_MUTEX_INITIALIZER, .cv=PTHREAD_COND_INITIALIZER};
+
+/* --engine=uring: each worker thread has its own io_uring, set up with the raw syscalls. A pool
+ * of registered buffers is shared by all files in the ring; every buffer carries one linked
+ * READ_FIXED -> WRITE_FIXED pair, so up to RING_BUFS pairs are in flight. Files are only queued
+ * as they come: the SQEs go out in one io_uring_enter() once every buffer or RING_FILES files
+ * are taken, or when the worker runs out of tasks, so many small files share a submission.
+ * A short read breaks the link: the cancelled write is issued for what was read, then the rest
+ * is read again. Only a read that returns 0 means the file shrank. */
+typedef struct UFile {
+    int in, out; off_t size, issued;
+    int inflight, err;
+    bool queued;              // still on the issue queue, so not finished by its last completion
+    bool sync;                // the kernel cannot do fixed reads or writes here: copy_data() takes over
+    char *src, *dst;
+    struct UFile *next;       // issue queue
+} UFile;
+
+typedef struct { UFile *f; off_t off; unsigned len, done, rest; int got; } Slot;   // slot i owns buffer i, rest is still to read
+
+struct Ring {
+    int fd; bool verbose;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes; struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr; size_t sq_sz, cq_sz, sqes_sz;
+    char *bufs;
+    Slot slots[RING_BUFS]; int freel[RING_BUFS], nfree;
+    UFile *qhead, *qtail; int live, inflight;
+    unsigned queued;          // SQEs not submitted yet
+};
+
+static __thread Ring *my_ring;
+static __thread bool  ring_broken;   // setup or submission failed once on this thread: stay synchronous
+
+static void ring_free(Ring *r){
+    if (r->bufs) munmap(r->bufs,RING_BUFS*RING_BUF);
+    if (r->sqes) munmap(r->sqes,r->sqes_sz);
+    if (r->cq_ptr && r->cq_ptr!=r->sq_ptr) munmap(r->cq_ptr,r->cq_sz);
+    if (r->sq_ptr) munmap(r->sq_ptr,r->sq_sz);
+    if (r->fd>=0) close(r->fd);
+    free(r);
+}
+
+static Ring* ring_new(bool verbose){
+    Ring *r=calloc(1,sizeof *r);
+    if (!r) return NULL;
+    struct io_uring_params p; memset(&p,0,sizeof p);
+    r->fd=(int)syscall(__NR_io_uring_setup,2*RING_BUFS,&p); r->verbose=verbose;
+    if (r->fd<0){ r->fd=-1; goto fail; }
+
+    r->sq_sz=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+    r->cq_sz=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) r->sq_sz=r->cq_sz=r->sq_sz>r->cq_sz? r->sq_sz : r->cq_sz;
+    r->sq_ptr=mmap(NULL,r->sq_sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_SQ_RING);
+    if (r->sq_ptr==MAP_FAILED){ r->sq_ptr=NULL; goto fail; }
+    r->cq_ptr=(p.features & IORING_FEAT_SINGLE_MMAP)? r->sq_ptr
+             : mmap(NULL,r->cq_sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_CQ_RING);
+    if (r->cq_ptr==MAP_FAILED){ r->cq_ptr=NULL; goto fail; }
+    r->sqes_sz=p.sq_entries*sizeof(struct io_uring_sqe);
+    r->sqes=mmap(NULL,r->sqes_sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_SQES);
+    if (r->sqes==MAP_FAILED){ r->sqes=NULL; goto fail; }
+
+    char *sq=r->sq_ptr, *cq=r->cq_ptr;
+    r->sq_head=(unsigned*)(sq+p.sq_off.head); r->sq_tail=(unsigned*)(sq+p.sq_off.tail);
+    r->sq_mask=(unsigned*)(sq+p.sq_off.ring_mask); r->sq_array=(unsigned*)(sq+p.sq_off.array);
+    r->cq_head=(unsigned*)(cq+p.cq_off.head); r->cq_tail=(unsigned*)(cq+p.cq_off.tail);
+    r->cq_mask=(unsigned*)(cq+p.cq_off.ring_mask); r->cqes=(struct io_uring_cqe*)(cq+p.cq_off.cqes);
+
+    r->bufs=mmap(NULL,RING_BUFS*RING_BUF,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (r->bufs==MAP_FAILED){ r->bufs=NULL; goto fail; }
+    struct iovec iov[RING_BUFS];
+    for (int i=0;i<RING_BUFS;i++){ iov[i]=(struct iovec){r->bufs+i*RING_BUF,RING_BUF}; r->freel[i]=i; }
+    r->nfree=RING_BUFS;
+    if (syscall(__NR_io_uring_register,r->fd,IORING_REGISTER_BUFFERS,iov,RING_BUFS)<0) goto fail;
+    return r;
+fail:
+    if (verbose) perr("io_uring is not available, copying synchronously");
+    ring_free(r);
+    return NULL;
+}
+
+static Ring* ring_get(bool verbose){
+    if (!my_ring && !ring_broken && !(my_ring=ring_new(verbose))) ring_broken=true;
+    return ring_broken? NULL : my_ring;
+}
+
+static void ring_sqe(Ring *r, int op, int fd, int slot, unsigned len, off_t off, unsigned flags, uint64_t ud){
+    unsigned tail=*r->sq_tail, idx=tail & *r->sq_mask;
+    struct io_uring_sqe *e=&r->sqes[idx];
+    memset(e,0,sizeof *e);
+    e->opcode=(uint8_t)op; e->flags=(uint8_t)flags; e->fd=fd;
+    e->addr=(uint64_t)(uintptr_t)(r->bufs+slot*RING_BUF+r->slots[slot].done);
+    e->len=len; e->off=(uint64_t)off; e->buf_index=(uint16_t)slot; e->user_data=ud;
+    r->sq_array[idx]=idx;
+    __atomic_store_n(r->sq_tail,tail+1,__ATOMIC_RELEASE);
+    r->queued++;
+}
+
+static void ufile_done(Ring *r, UFile *f, const char *how){
+    if (close(f->in)!=0 && !f->err) f->err=errno;
+    if (close(f->out)!=0 && !f->err) f->err=errno;
+    if (f->err>0){ errno=f->err; perr("error copying '%s' to '%s'",f->src,f->dst); }   // -1: reported already
+    if (f->err) atomic_store(&pool.failed,1);
+    else if (r->verbose) printf("'%s' -> '%s' (%s)\n",f->src,f->dst,how);
+    free(f->src); free(f->dst); free(f);
+    r->live--;
+}
+
+static void ufile_finish(Ring *r, UFile *f){
+    char how[64]="io_uring"; struct stat ss;
+    if (f->sync && !f->err){   // start over from offset 0, the ring never moved the file offsets
+        if (fstat(f->in,&ss)<0 || ftruncate(f->out,0)<0) f->err=errno;
+        else if (copy_data(f->in,f->out,&ss,f->src,f->dst,pool.o,how,sizeof how)<0) f->err=-1;
+    }
+    else if (!f->err && ftruncate(f->out,f->size)<0) f->err=errno;   // drop the tail when the source shrank
+    ufile_done(r,f,how);
+}
+
+static void ring_pair(Ring *r, int i){
+    Slot *s=&r->slots[i];
+    ring_sqe(r,IORING_OP_READ_FIXED,s->f->in,i,s->len,s->off,IOSQE_IO_LINK,(uint64_t)i<<1);
+    ring_sqe(r,IORING_OP_WRITE_FIXED,s->f->out,i,s->len,s->off,0,(uint64_t)i<<1|1);
+}
+
+// Hands free buffers to the queued files in order: a big file gets them all, small ones share
+static void ring_fill(Ring *r){
+    while (r->nfree>0 && r->qhead){
+        UFile *f=r->qhead;
+        if (f->err || f->sync || f->issued>=f->size){
+            r->qhead=f->next; if (!r->qhead) r->qtail=NULL;
+            f->queued=false;
+            if (f->inflight==0) ufile_finish(r,f);
+            continue;
+        }
+        int i=r->freel[--r->nfree]; Slot *s=&r->slots[i];
+        off_t left=f->size-f->issued;
+        *s=(Slot){f,f->issued,(unsigned)(left<RING_BUF? left : RING_BUF),0,0,0};
+        f->issued+=s->len; f->inflight++; r->inflight++;
+        ring_pair(r,i);
+    }
+}
+
+static void ring_cqe(Ring *r, uint64_t ud, int res){
+    int i=(int)(ud>>1); Slot *s=&r->slots[i]; UFile *f=s->f;
+    if (!(ud&1)){   // the read: its write follows, or is cancelled if this came up short
+        s->got=res<0? 0 : res;
+        if (res<0 && unsupported(-res)) f->sync=true;
+        else if (res<0){ if (!f->err) f->err=-res; }
+        else if (res==0){ if (f->size>s->off) f->size=s->off; }   // EOF moved
+        else if ((unsigned)res<s->len) s->rest=s->len-(unsigned)res;
+        return;
+    }
+    if (res==-ECANCELED) s->len=(unsigned)s->got;   // write what the short read got, if anything
+    else if (res<0 && unsupported(-res)) f->sync=true;
+    else if (res<0){ if (!f->err) f->err=-res; }
+    else if (res==0){ if (!f->err) f->err=EIO; }
+    else s->done+=(unsigned)res;
+
+    if (!f->err && !f->sync){
+        if (s->done<s->len){   // short write
+            ring_sqe(r,IORING_OP_WRITE_FIXED,f->out,i,s->len-s->done,s->off+s->done,0,(uint64_t)i<<1|1);
+            return;
+        }
+        if (s->rest){          // short read: the rest of the range into the same buffer
+            s->off+=s->len; s->len=s->rest; s->done=s->rest=0; s->got=0;
+            ring_pair(r,i);
+            return;
+        }
+    }
+    s->f=NULL; r->freel[r->nfree++]=i; r->inflight--;
+    if (--f->inflight==0 && !f->queued) ufile_finish(r,f);
+}
+
+// The ring cannot be entered any more: nothing in flight will be reaped, so every file it holds,
+// in flight or still queued, is copied again from the start by copy_data(). Later files never
+// reach the ring. The SQEs it still owns only go away with ring_free().
+static void ring_abandon(Ring *r){
+    if (r->verbose) perr("io_uring_enter failed, copying synchronously");
+    ring_broken=true;
+    for (UFile *f=r->qhead; f; f=f->next) f->sync=true;
+    for (int i=0;i<RING_BUFS;i++){
+        Slot *s=&r->slots[i]; UFile *f=s->f;
+        if (!f) continue;
+        f->sync=true; s->f=NULL; r->freel[r->nfree++]=i; r->inflight--;
+        if (--f->inflight==0 && !f->queued) ufile_finish(r,f);
+    }
+    r->queued=0;
+    ring_fill(r);   // every buffer is free now, so this finishes the whole queue
+}
+
+// Submits what is queued and reaps what is done; with wait, sleeps for at least one completion
+static void ring_pump(Ring *r, bool wait){
+    ring_fill(r);
+    wait=wait && r->inflight>0;
+    bool failed=false;
+    while (r->queued>0 || wait){
+        int n=(int)syscall(__NR_io_uring_enter,r->fd,r->queued,wait? 1 : 0,wait? IORING_ENTER_GETEVENTS : 0,NULL,0);
+        if (n<0){
+            if (errno==EINTR) continue;
+            failed=true;
+            break;
+        }
+        r->queued-=(unsigned)n;
+        break;
+    }
+    unsigned head=*r->cq_head, tail=__atomic_load_n(r->cq_tail,__ATOMIC_ACQUIRE);
+    for (; head!=tail; head++){
+        struct io_uring_cqe *c=&r->cqes[head & *r->cq_mask];
+        uint64_t ud=c->user_data; int res=c->res;
+        __atomic_store_n(r->cq_head,head+1,__ATOMIC_RELEASE);
+        ring_cqe(r,ud,res);
+    }
+    if (failed) ring_abandon(r);   // only after the reaping: posted completions still point at their slots
+}
+
+static int ring_add(Ring *r, int in, int out, off_t size, const char *src, const char *dst){
+    UFile *f=calloc(1,sizeof *f);
+    if (f){ f->src=strdup(src); f->dst=strdup(dst); }
+    if (!f || !f->src || !f->dst){
+        perr("cannot copy '%s'",src);
+        if (f){ free(f->src); free(f->dst); free(f); }
+        close(in); close(out); return -1;
+    }
+    f->in=in; f->out=out; f->size=size;
+    r->live++;
+    if (r->qtail) r->qtail->next=f; else r->qhead=f;
+    r->qtail=f; f->queued=true;
+    ring_fill(r);
+    if (r->nfree==0 || r->live>=RING_FILES) ring_pump(r,false);
+    while (r->live>RING_FILES) ring_pump(r,true);
+    return 0;
+}
+
+static void ring_drain(Ring *r){
+    while (r->live>0) ring_pump(r,true);
+}
+
+static void dq_push(Deque *q, Task t){
+    pthread_mutex_lock(&q->mu);
+    if (q->len==q->cap){
+        size_t cap=q->cap? q->cap*2 : 64;
+        Task *buf=malloc(cap*sizeof *buf);
+        if (!buf){ perror("cp"); exit(1); }
+        for (size_t i=0;i<q->len;i++) buf[i]=q->buf[(q->head+i)%q->cap];
+        free(q->buf); q->buf=buf; q->cap=cap; q->head=0;
+    }
+    q->buf[(q->head+q->len++)%q->cap]=t;
+    atomic_store(&q->size,q->len);
+    pthread_mutex_unlock(&q->mu);
+}
+static bool dq_take(Deque *q, Task *t, bool back){
+    if (atomic_load(&q->size)==0) return false;
+    pthread_mutex_lock(&q->mu);
+    bool ok=q->len>0;
+    if (ok){
+        if (back) *t=q->buf[(q->head+q->len-1)%q->cap];
+        else { *t=q->buf[q->head]; q->head=(q->head+1)%q->cap; }
+        q->len--; atomic_store(&q->size,q->len);
+    }
+    pthread_mutex_unlock(&q->mu);
+    return ok;
+}
+
+static void push_task(int me, Task t){
+    if (t.at) atomic_fetch_add(&t.at->refs,1);
+    atomic_fetch_add(&pool.pending,1);
+    dq_push(&pool.q[me],t);
+    if (atomic_load(&pool.idle)>0){ pthread_mutex_lock(&pool.mu); pthread_cond_signal(&pool.cv); pthread_mutex_unlock(&pool.mu); }
+}
+
+// Own deque first, then the others; sleeps while there is nothing anywhere but work still running
+static bool next_task(int me, Task *t){
+    for (;;){
+        if (dq_take(&pool.q[me],t,true)) return true;
+        for (int k=1;k<pool.nq;k++) if (dq_take(&pool.q[(me+k)%pool.nq],t,false)) return true;
+
+        if (my_ring && my_ring->live>0){ ring_drain(my_ring); continue; }   // finish our files before sleeping
+
+        pthread_mutex_lock(&pool.mu);
+        atomic_fetch_add(&pool.idle,1);
+        bool any=false;
+        for (int k=0;k<pool.nq && !any;k++) any=atomic_load(&pool.q[k].size)>0;
+        if (!any && !pool.done) pthread_cond_wait(&pool.cv,&pool.mu);
+        atomic_fetch_sub(&pool.idle,1);
+        bool done=pool.done;
+        pthread_mutex_unlock(&pool.mu);
+        if (done) return false;
+    }
+}
+
+static void dir_put(Dir *d){
+    if (atomic_fetch_sub(&d->refs,1)!=1) return;
+    if (d->made && fchmod(d->dfd,d->mode)<0){ perr("cannot set permissions of '%s'",d->dpath); atomic_store(&pool.failed,1); }
+    close(d->sfd); close(d->dfd); free(d->spath); free(d->dpath); free(d);
+}
+
+static char* join(const char *dir, const char *name){
+    size_t len=strlen(dir); bool slash=len>0 && dir[len-1]=='/';
+    char *p=malloc(len+strlen(name)+2);
+    if (p) sprintf(p,"%s%s%s",dir,slash? "" : "/",name);
+    return p;
+}
+
+// Whether the directory that will hold d->name is st or lies below it: copying st there
+// would go on forever. Walks up with "..", it is done once per operand.
+static bool inside(const Loc *d, const struct stat *st){
+    char parent[PATH_MAX]; snprintf(parent,sizeof parent,"%s",d->name);
+    char *slash=strrchr(parent,'/');
+    if (!slash) strcpy(parent,".");
+    else if (slash==parent) slash[1]=0;
+    else *slash=0;
+
+    bool hit=false; struct stat cs, ps;
+    int cur=openat(d->at,parent,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    while (cur>=0 && fstat(cur,&cs)==0 && !(hit=same_file(&cs,st))){
+        int up=openat(cur,"..",O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        close(cur); cur=up;
+        if (cur>=0 && fstat(cur,&ps)==0 && same_file(&ps,&cs)) break;   // "/" is its own parent
+    }
+    if (cur>=0) close(cur);
+    return hit;
+}
+
+static int copy_dir(int me, const Loc *s, const Loc *d, bool operand){
+    const Opt *o=pool.o;
+    int sfd=openat(s->at,s->name,O_RDONLY|O_DIRECTORY|O_CLOEXEC|(operand? 0 : O_NOFOLLOW));
+    if (sfd<0){ perr("cannot access '%s'",s->path); return -1; }
+    struct stat ss;
+    if (fstat(sfd,&ss)<0){ perr("cannot stat '%s'",s->path); close(sfd); return -1; }
+    if (operand && inside(d,&ss)){ perr_msg("cannot copy a directory, '%s', into itself, '%s'",s->path,d->path); close(sfd); return -1; }
+    bool made=mkdirat(d->at,d->name,0700)==0;
+    if (!made && errno!=EEXIST){ perr("cannot create directory '%s'",d->path); close(sfd); return -1; }
+    int dfd=openat(d->at,d->name,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (dfd<0){
+        if (errno==ENOTDIR) perr_msg("cannot overwrite non-directory '%s' with directory '%s'",d->path,s->path);
+        else perr("cannot open directory '%s'",d->path);
+        close(sfd); return -1;
+    }
+    if (made && o->v) printf("'%s' -> '%s'\n",s->path,d->path);
+
+    Dir *dir=calloc(1,sizeof *dir);
+    char *spath=strdup(s->path), *dpath=strdup(d->path);   // run_task() joins the entry names to them
+    int lfd=dup(sfd);
+    DIR *ls=lfd<0? NULL : fdopendir(lfd);
+    if (!dir || !spath || !dpath || !ls){
+        perr("cannot read directory '%s'",s->path);
+        if (ls) closedir(ls); else if (lfd>=0) close(lfd);
+        free(dir); free(spath); free(dpath); close(sfd); close(dfd); return -1;
+    }
+    dir->sfd=sfd; dir->dfd=dfd; dir->mode=ss.st_mode&07777; dir->made=made;
+    dir->spath=spath; dir->dpath=dpath;
+    atomic_init(&dir->refs,1);
+
+    int rc=0;
+    for (struct dirent *e; (errno=0, e=readdir(ls)); ){
+        if (!strcmp(e->d_name,".") || !strcmp(e->d_name,"..")) continue;
+        Task t={dir,strdup(e->d_name),NULL,e->d_type};
+        if (!t.name){ perror("cp"); rc=-1; break; }
+        push_task(me,t);
+    }
+    if (errno){ perr("cannot read directory '%s'",s->path); rc=-1; }
+    closedir(ls);
+    dir_put(dir);
     return rc;
 }
 
+static int run_task(int me, Task *t){
+    char *sp=t->at? join(t->at->spath,t->name) : NULL, *dp=t->at? join(t->at->dpath,t->name) : NULL;
+    Loc s={t->at? t->at->sfd : AT_FDCWD, t->name, sp? sp : t->name};
+    Loc d={t->at? t->at->dfd : AT_FDCWD, t->dname? t->dname : t->name, dp? dp : t->dname};
+    int rc=-1;
+    if (t->at && (!sp || !dp)){ perror("cp"); goto out; }
+
+    unsigned char type=t->type;
+    if (type==DT_UNKNOWN){
+        struct stat st;
+        if (fstatat(s.at,s.name,&st,t->at? AT_SYMLINK_NOFOLLOW : 0)<0){ perr("cannot stat '%s'",s.path); goto out; }
+        type=S_ISDIR(st.st_mode)? DT_DIR : S_ISLNK(st.st_mode)? DT_LNK : DT_REG;
+    }
+    if (type==DT_DIR && pool.o->r) rc=copy_dir(me,&s,&d,t->at==NULL);
+    else if (type==DT_LNK && t->at) rc=copy_link(&s,&d,pool.o);
+    else rc=copy1(&s,&d,pool.o);
+out:
+    free(sp); free(dp); free(t->name); free(t->dname);
+    if (t->at) dir_put(t->at);
+    return rc;
+}
+
+static void* worker(void *arg){
+    int me=(int)(intptr_t)arg; Task t;
+    while (next_task(me,&t)){
+        if (run_task(me,&t)!=0) atomic_store(&pool.failed,1);
+        if (atomic_fetch_sub(&pool.pending,1)==1){
+            pthread_mutex_lock(&pool.mu); pool.done=true; pthread_cond_broadcast(&pool.cv); pthread_mutex_unlock(&pool.mu);
+        }
+    }
+    if (my_ring){ ring_drain(my_ring); ring_free(my_ring); my_ring=NULL; }
+    return NULL;
+}
+
+// The operands are spread over the deques, then the calling thread works as worker 0
+static int run_pool(Task *ops, int nops, const Opt *o){
+    int nt=o->r? o->threads : (o->threads<nops? o->threads : nops);
+    if (nt<1) nt=1;
+    pool.o=o; pool.nq=nt;
+    for (int k=0;k<nt;k++) pthread_mutex_init(&pool.q[k].mu,NULL);
+    for (int i=0;i<nops;i++) push_task(i%nt,ops[i]);
+
+    if (o->r){   // a wide tree keeps two fds per directory that still has children queued
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE,&rl)==0 && rl.rlim_cur<rl.rlim_max){ rl.rlim_cur=rl.rlim_max; setrlimit(RLIMIT_NOFILE,&rl); }
+    }
+    pthread_t tid[MAX_THREADS]; int started=1;
+    for (; started<nt; started++)
+        if (pthread_create(&tid[started],NULL,worker,(void*)(intptr_t)started)!=0) break;
+    worker((void*)0);
+    for (int k=1;k<started;k++) pthread_join(tid[k],NULL);
+    return atomic_load(&pool.failed);
+}
+
 static void usage(const char *p){
     fprintf(stderr,"Usage: %s [OPTIONS] SRC DST\n       %s [OPTIONS] SRC... DIR\n",p,p);
+    fprintf(stderr,"  -r, -R, --recursive  copy directories recursively\n"
+                   "  --threads=N          workers for -r and several sources (default: online CPUs)\n"
+                   "  --chunk-threads=N    copy each file bigger than a chunk with N threads at once\n"
+                   "  --chunk-size=SIZE    extent per chunk thread, with K, M or G (default: 64M)\n"
+                   "  --engine=sync|uring  blocking copy calls, or batched io_uring reads and writes\n"
+                   "  --sparse=WHEN        keep the holes of sparse files: auto (default), always\n"
+                   "                       (also turn all-zero blocks into holes) or never\n"
+                   "  --direct             read and write with O_DIRECT, past the page cache\n"
+                   "  --nocache            drop copied data from the page cache as the copy goes\n");
 }
 
+// DIR/SRC for SRC, ignoring trailing slashes of SRC
+static char* target_in(const char *dir, const char *src){
+    size_t len=strlen(src);
+    while (len>1 && src[len-1]=='/') len--;
+    const char *b=src+len; while (b>src && b[-1]!='/') b--;
+    char *name=strndup(b,(size_t)(src+len-b));
+    char *to=name? join(dir,name) : NULL;
+    free(name);
+    return to;
+}
 
+// 512, 64K, 16M, 2G
+static bool parse_size(const char *a, off_t *out){
+    char *end; long long v=strtoll(a,&end,10);
+    int shift=*end=='K'||*end=='k'? 10 : *end=='M'||*end=='m'? 20 : *end=='G'||*end=='g'? 30 : 0;
+    if (v<=0 || end==a || (shift && *++end) || (!shift && *end) || v>(LLONG_MAX>>shift)) return false;
+    *out=(off_t)(v<<shift);
+    return true;
+}
 
 int main(int argc, char **argv){
-    int PATH_MAX = 4096;
-    Opt o={0}; const char *paths[argc]; int n=0; bool endopts=false;
+    Opt o={.chunk_size=SPLIT_CHUNK}; const char *paths[argc]; int n=0; bool endopts=false;
+    long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+    o.threads=cpus<1? 1 : cpus>MAX_THREADS? MAX_THREADS : (int)cpus;
     for (int i=1;i<argc;i++){
         const char *a=argv[i];
         if (!endopts && strcmp(a,"--")==0){ endopts=true; continue; }
         if (!endopts && !strcmp(a,"--verbose")){ o.v=true; continue; }
         if (!endopts && !strcmp(a,"--interactive")){ o.i=true; o.f=false; continue; }
         if (!endopts && !strcmp(a,"--force")){ o.f=true; o.i=false; continue; }
+        if (!endopts && !strcmp(a,"--recursive")){ o.r=true; continue; }
+        if (!endopts && !strncmp(a,"--threads=",10)){
+            char *end; long t=strtol(a+10,&end,10);
+            if (*end || t<1 || t>MAX_THREADS){ perr_msg("invalid thread count '%s'",a+10); return 1; }
+            o.threads=(int)t; continue;
+        }
+        if (!endopts && !strncmp(a,"--chunk-threads=",16)){
+            char *end; long t=strtol(a+16,&end,10);
+            if (*end || t<1 || t>MAX_THREADS){ perr_msg("invalid thread count '%s'",a+16); return 1; }
+            o.chunk_threads=(int)t; continue;
+        }
+        if (!endopts && !strncmp(a,"--engine=",9)){
+            if (!strcmp(a+9,"uring")) o.uring=true;
+            else if (!strcmp(a+9,"sync")) o.uring=false;
+            else { perr_msg("unknown engine '%s'",a+9); return 1; }
+            continue;
+        }
+        if (!endopts && !strcmp(a,"--direct")){ o.direct=true; continue; }
+        if (!endopts && !strcmp(a,"--nocache")){ o.nocache=true; continue; }
+        if (!endopts && !strncmp(a,"--sparse=",9)){
+            if (!strcmp(a+9,"auto")) o.sparse=SPARSE_AUTO;
+            else if (!strcmp(a+9,"always")) o.sparse=SPARSE_ALWAYS;
+            else if (!strcmp(a+9,"never")) o.sparse=SPARSE_NEVER;
+            else { perr_msg("invalid argument '%s' for '--sparse'",a+9); return 1; }
+            continue;
+        }
+        if (!endopts && !strncmp(a,"--chunk-size=",13)){
+            if (!parse_size(a+13,&o.chunk_size)){ perr_msg("invalid chunk size '%s'",a+13); return 1; }
+            continue;
+        }
         if (!endopts && a[0]=='-' && a[1]){
             for (const char *p=a+1; *p; ++p){
                 if (*p=='v') o.v=true;
                 else if (*p=='i'){ o.i=true; o.f=false; }
                 else if (*p=='f'){ o.f=true; o.i=false; }
+                else if (*p=='r' || *p=='R') o.r=true;
                 else { usage(argv[0]); return 1; }
             }
             continue;
@@ -91,23 +915,16 @@ int main(int argc, char **argv){
         paths[n++]=a;
     }
     if (n<2){ usage(argv[0]); return 1; }
+    if (o.i) o.threads=1;   // one question at a time, in operand order
 
-    int rc=0;
-    if (n==2){
-        const char *src=paths[0], *dst=paths[1];
-        if (is_dir(dst)){
-            char to[PATH_MAX]; snprintf(to,sizeof to,"%s/%s",dst,base(src));
-            if (copy1(src,to,&o)!=0) rc=1;
-        }else{
-            if (copy1(src,dst,&o)!=0) rc=1;
-        }
+    Task ops[n]; int nops=0;
+    if (n==2 && !is_dir(paths[1])){
+        ops[nops++]=(Task){NULL,strdup(paths[0]),strdup(paths[1]),DT_UNKNOWN};
     }else{
         const char *dir=paths[n-1];
         if (!is_dir(dir)){ perr_msg("target '%s' is not a directory",dir); return 1; }
-        for (int i=0;i<n-1;i++){
-            char to[PATH_MAX]; snprintf(to,sizeof to,"%s/%s",dir,base(paths[i]));
-            if (copy1(paths[i],to,&o)!=0) rc=1;
-        }
+        for (int i=0;i<n-1;i++) ops[nops++]=(Task){NULL,strdup(paths[i]),target_in(dir,paths[i]),DT_UNKNOWN};
     }
-    return rc;
+    for (int i=0;i<nops;i++) if (!ops[i].name || !ops[i].dname){ perror("cp"); return 1; }
+    return run_pool(ops,nops,&o)? 1 : 0;
 }
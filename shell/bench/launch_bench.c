@@ -0,0 +1,216 @@
+// Launch latency of RunCmd(): pipelines of 1..N trivial stages, every launcher, and a parent
+// whose resident set is inflated to several sizes, since fork() cost grows with it.
+// Prints one CSV row per (launcher, rss, stages) with latency percentiles in microseconds.
+
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "command_parser.h"
+#include "jobs.h"
+#include "launcher.h"
+#include "path_cache.h"
+#include "pipe_buffer.h"
+#include "run_cmd.h"
+#include "variables.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MAX_STAGES 16
+#define DEFAULT_ITERATIONS 200
+#define DEFAULT_PROGRAM    "/bin/true"
+#define MAX_RSS_SIZES      16
+
+static const size_t DEFAULT_RSS_MB[] = {0, 64, 512};
+
+typedef struct {
+    size_t     max_stages;
+    size_t     iterations;
+    const char *program;
+    size_t     rss_mb[MAX_RSS_SIZES];
+    size_t     rss_count;
+} BenchOptions;
+
+static void   usage       (const char *prog);
+static int    parseRssList(char *list, BenchOptions *opts);
+static char*  buildLine   (const char *program, size_t stages);
+static double nowUs       ();
+static int    compareUs   (const void *a, const void *b);
+static double percentile  (const double *sorted, size_t count, double p);
+static char*  inflateHeap (char *heap, size_t old_mb, size_t new_mb);
+static int    benchLine   (const char *line, const RunOptions *run, size_t iterations, double *samples);
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n max_stages] [-i iterations] [-m rss_mb,...] [-p program]\n", prog);
+}
+
+static int parseRssList(char *list, BenchOptions *opts) {
+    opts->rss_count = 0;
+    for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (opts->rss_count == MAX_RSS_SIZES) {
+            return -1;
+        }
+        opts->rss_mb[opts->rss_count++] = strtoul(tok, NULL, 10);
+    }
+    return opts->rss_count > 0 ? 0 : -1;
+}
+
+static char* buildLine(const char *program, size_t stages) {
+    size_t len  = stages * (strlen(program) + 3) + 2;
+    char  *line = (char*)calloc(len, sizeof(char));
+    if (line == NULL) {
+        return NULL;
+    }
+
+    char *p = line;
+    for (size_t i = 0; i < stages; i++) {
+        p = stpcpy(p, i > 0 ? " | " : "");
+        p = stpcpy(p, program);
+    }
+    strcpy(p, "\n");
+    return line;
+}
+
+static double nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int compareUs(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t count, double p) {
+    size_t idx = (size_t)(p * (double)(count - 1) + 0.5);
+    return sorted[idx];
+}
+
+// Every page is written so it is really resident and has to be mapped into each fork() child
+static char* inflateHeap(char *heap, size_t old_mb, size_t new_mb) {
+    if (new_mb == old_mb) {
+        return heap;
+    }
+    free(heap);
+    if (new_mb == 0) {
+        return NULL;
+    }
+
+    size_t size = new_mb << 20;
+    heap = (char*)malloc(size);
+    if (heap != NULL) {
+        long page = sysconf(_SC_PAGESIZE);
+        for (size_t off = 0; off < size; off += (size_t)page) {
+            heap[off] = 1;
+        }
+    }
+    return heap;
+}
+
+static int benchLine(const char *line, const RunOptions *run, size_t iterations, double *samples) {
+    CommandLine *cline = InitCommandLine();
+    if (cline == NULL || ParseCommandLine(line, cline) != OK) {
+        FreeCommandLine(cline);
+        return -1;
+    }
+
+    RunCmd(cline, run);  // warm-up: fills the path cache and faults in the launcher code
+
+    for (size_t i = 0; i < iterations; i++) {
+        double start = nowUs();
+        RunCmd(cline, run);
+        samples[i] = nowUs() - start;
+    }
+
+    FreeCommandLine(cline);
+    return 0;
+}
+
+int main(int argc, char *argv[], char *envp[]) {
+    BenchOptions opts = {
+        .max_stages = DEFAULT_MAX_STAGES,
+        .iterations = DEFAULT_ITERATIONS,
+        .program    = DEFAULT_PROGRAM,
+        .rss_count  = sizeof(DEFAULT_RSS_MB) / sizeof(DEFAULT_RSS_MB[0]),
+    };
+    memcpy(opts.rss_mb, DEFAULT_RSS_MB, sizeof(DEFAULT_RSS_MB));
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "n:i:m:p:")) != -1) {
+        switch (opt) {
+            case 'n': opts.max_stages = strtoul(optarg, NULL, 10); break;
+            case 'i': opts.iterations = strtoul(optarg, NULL, 10); break;
+            case 'p': opts.program    = optarg; break;
+            case 'm':
+                if (parseRssList(optarg, &opts) != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (opts.max_stages == 0 || opts.iterations == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    double *samples = (double*)calloc(opts.iterations, sizeof(double));
+    if (samples == NULL || VarsInit(envp) != OK || JobsInit(0) != OK) {
+        fprintf(stderr, "failed to set up the benchmark\n");
+        return 1;
+    }
+
+    static const LaunchMode MODES[] = {LAUNCH_FORK, LAUNCH_VFORK, LAUNCH_CLONE, LAUNCH_SPAWN};
+
+    printf("launcher,rss_mb,stages,iterations,min_us,p50_us,p90_us,p99_us,max_us,per_stage_p50_us\n");
+
+    char   *heap    = NULL;
+    size_t  heap_mb = 0;
+    for (size_t r = 0; r < opts.rss_count; r++) {
+        heap    = inflateHeap(heap, heap_mb, opts.rss_mb[r]);
+        heap_mb = heap != NULL ? opts.rss_mb[r] : 0;
+        if (heap_mb != opts.rss_mb[r]) {
+            fprintf(stderr, "cannot inflate the heap to %zu MiB, skipping\n", opts.rss_mb[r]);
+            continue;
+        }
+
+        for (size_t m = 0; m < sizeof(MODES) / sizeof(MODES[0]); m++) {
+            RunOptions run = {
+                .launcher    = MODES[m],
+                .buffer_size = PIPE_BUFFER_DEFAULT,
+            };
+
+            for (size_t stages = 1; stages <= opts.max_stages; stages++) {
+                char *line = buildLine(opts.program, stages);
+                if (line == NULL || benchLine(line, &run, opts.iterations, samples) != 0) {
+                    fprintf(stderr, "cannot run '%s'\n", opts.program);
+                    free(line);
+                    continue;
+                }
+                free(line);
+
+                qsort(samples, opts.iterations, sizeof(double), compareUs);
+                double p50 = percentile(samples, opts.iterations, 0.50);
+                printf("%s,%zu,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+                       LaunchModeName(MODES[m]), heap_mb, stages, opts.iterations,
+                       samples[0], p50,
+                       percentile(samples, opts.iterations, 0.90),
+                       percentile(samples, opts.iterations, 0.99),
+                       samples[opts.iterations - 1], p50 / (double)stages);
+                fflush(stdout);
+            }
+        }
+    }
+
+    free(heap);
+    free(samples);
+    PathCacheClear();
+    JobsShutdown();
+    VarsFree();
+    return 0;
+}
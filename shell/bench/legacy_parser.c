@@ -0,0 +1,173 @@
+#include "legacy_parser.h"
+
+#include <ctype.h>
+
+#define PIPE_SEPARATOR        "|"
+#define ARGUMENT_SEPARATORS   " \t\n"
+
+static char*    fixBeforeTok(char *tok, char *pipe_pos);
+static char*    fixAfterTok (char *pipe_pos);
+static CmdError InitCommand (LegacyCommand *cmd);
+static CmdError AddArgument (LegacyCommand *cmd, char *arg);
+
+// Frees every command that was started, including the unfinished one an error left behind
+void LegacyFree(LegacyLine *line) {
+    for (size_t i = 0; i < LEGACY_MAX_COMMANDS; i++) {
+        if (line->cmds[i].argv == NULL) {
+            continue;
+        }
+        for (size_t j = 0; j < line->cmds[i].argc; j++) {
+            free(line->cmds[i].argv[j]);
+        }
+        free(line->cmds[i].argv);
+        line->cmds[i].argv = NULL;
+        line->cmds[i].argc = 0;
+    }
+    line->cmd_count = 0;
+}
+
+static CmdError InitCommand(LegacyCommand *cmd) {
+    assert(cmd);
+
+    cmd->argv = (char**)calloc(LEGACY_MAX_ARGS, sizeof(char*));
+    if (cmd->argv == NULL) {
+        return ALLOC_ERR;
+    }
+
+    cmd->argc = 0;
+    return OK;
+}
+
+static CmdError AddArgument(LegacyCommand *cmd, char *arg) {
+    if (cmd->argc >= LEGACY_MAX_ARGS - 1) {
+        free(arg);
+        return LEGACY_TOO_MANY_ARGS;
+    }
+    cmd->argv[cmd->argc++] = arg;
+    return OK;
+}
+
+// `out` must be zeroed; LegacyFree() it afterwards whatever this returns
+CmdError LegacyParse(const char *input, LegacyLine *out) {
+    assert(input);
+    assert(out);
+
+    char* input_copy = strdup(input);
+    if (input_copy == NULL) {
+        return ALLOC_ERR;
+    }
+
+    if (InitCommand(&out->cmds[0]) != OK) {
+        free(input_copy);
+        return ALLOC_ERR;
+    }
+
+    char *save_ptr = NULL;
+    for (char *tok = strtok_r(input_copy, ARGUMENT_SEPARATORS, &save_ptr);
+         tok != NULL;
+         tok = strtok_r(NULL, ARGUMENT_SEPARATORS, &save_ptr))
+    {
+        LegacyCommand *cur = &out->cmds[out->cmd_count];
+        char *pipe_pos = strchr(tok, '|');
+
+        if (strcmp(tok, PIPE_SEPARATOR) == 0) {
+            out->cmd_count++;
+
+            if (out->cmd_count >= LEGACY_MAX_COMMANDS) {
+                free(input_copy);
+                return LEGACY_TOO_MANY_COMMANDS;
+            }
+
+            if (InitCommand(&out->cmds[out->cmd_count]) != OK) {
+                free(input_copy);
+                return ALLOC_ERR;
+            }
+
+            continue;
+        }
+
+        if (pipe_pos != NULL) {
+            char *before = fixBeforeTok(tok, pipe_pos);
+            if (before != NULL) {
+                if (AddArgument(cur, before) != OK) {
+                    free(input_copy);
+                    return LEGACY_TOO_MANY_ARGS;
+                }
+            }
+
+            out->cmd_count++;
+            if (out->cmd_count >= LEGACY_MAX_COMMANDS) {
+                free(input_copy);
+                return LEGACY_TOO_MANY_COMMANDS;
+            }
+
+            cur = &out->cmds[out->cmd_count];
+            if (InitCommand(cur) != OK) {
+                free(input_copy);
+                return ALLOC_ERR;
+            }
+
+            char *after = fixAfterTok(pipe_pos);
+            if (after != NULL) {
+                if (AddArgument(cur, after) != OK) {
+                    free(input_copy);
+                    return LEGACY_TOO_MANY_ARGS;
+                }
+            }
+
+            continue;
+        }
+
+        if (AddArgument(cur, strdup(tok)) != OK) {
+            free(input_copy);
+            return LEGACY_TOO_MANY_ARGS;
+        }
+    }
+
+    if (out->cmds[out->cmd_count].argc > 0) {
+        out->cmd_count++;
+    }
+
+    free(input_copy);
+    return OK;
+}
+
+static char* fixBeforeTok(char *tok, char *pipe_pos) {
+    assert(tok);
+    assert(pipe_pos);
+
+    size_t len_str = (size_t)(pipe_pos - tok);
+    if (len_str == 0) {
+        return NULL;
+    }
+
+    char *dup = (char*)calloc(len_str + 1, sizeof(char));
+    if (dup == NULL) {
+        return NULL;
+    }
+
+    return strncpy(dup, tok, len_str);
+}
+
+static char* fixAfterTok(char *pipe_pos) {
+    assert(pipe_pos);
+
+    if (strlen(pipe_pos) == 1) {
+        return NULL;
+    }
+    else {
+        char *start = pipe_pos + 1;
+
+        while (isspace(*start)) {
+            start++;
+        }
+
+        size_t len_str = strlen(start);
+        char *dup = (char*)calloc(len_str + 1, sizeof(char));
+        if (dup == NULL) {
+            return NULL;
+        }
+
+        return strncpy(dup, start, len_str);
+    }
+}
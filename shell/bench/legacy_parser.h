@@ -0,0 +1,28 @@
+#ifndef LEGACY_PARSER_H
+#define LEGACY_PARSER_H
+
+#include "common.h"
+
+// The strtok_r() parser the bitmask tokenizer replaced, kept as the reference for the
+// differential check in parse_fuzz: words split on " \t\n", commands on '|', nothing else.
+#define LEGACY_MAX_ARGS     256
+#define LEGACY_MAX_COMMANDS 16
+
+// Its limit errors, gone from common.h since argv and the command list grow on demand
+#define LEGACY_TOO_MANY_COMMANDS ((CmdError)0x0003)
+#define LEGACY_TOO_MANY_ARGS     ((CmdError)0x0004)
+
+typedef struct {
+    char    **argv;
+    size_t  argc;
+} LegacyCommand;
+
+typedef struct {
+    LegacyCommand cmds[LEGACY_MAX_COMMANDS];
+    size_t        cmd_count;
+} LegacyLine;
+
+CmdError LegacyParse(const char *input, LegacyLine *out);
+void     LegacyFree (LegacyLine *line);
+
+#endif // LEGACY_PARSER_H
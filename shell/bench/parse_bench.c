@@ -0,0 +1,162 @@
+// ParseCommandLine() throughput over the shared corpus: lines/s, bytes/s and heap
+// allocations per line, both for a reused CommandLine (how the shell runs) and for a
+// fresh InitCommandLine()/FreeCommandLine() pair around every parse.
+
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "command_parser.h"
+#include "parse_corpus.h"
+#include "scanner.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#define TARGET_BYTES   (64 * 1024 * 1024)  // input volume per corpus line and mode
+#define MIN_ITERATIONS 3
+#define MAX_ITERATIONS 1000000
+
+// Interposed allocator: every call goes through glibc's own entry points, and is counted
+extern void* __libc_malloc (size_t size);
+extern void* __libc_calloc (size_t count, size_t size);
+extern void* __libc_realloc(void *ptr, size_t size);
+extern void  __libc_free   (void *ptr);
+
+static size_t alloc_count = 0;
+
+void* malloc(size_t size) {
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    alloc_count++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+typedef struct {
+    double seconds;
+    size_t allocs;
+    size_t failures;
+} RunResult;
+
+static double    nowSec    ();
+static size_t    iterationsFor(size_t len);
+static RunResult runReused (const CorpusLine *line, size_t iterations);
+static RunResult runFresh  (const CorpusLine *line, size_t iterations);
+static void      report    (const char *mode, const CorpusLine *line, size_t iterations, RunResult r);
+
+static double nowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t iterationsFor(size_t len) {
+    size_t n = TARGET_BYTES / (len > 0 ? len : 1);
+    return n < MIN_ITERATIONS ? MIN_ITERATIONS : n > MAX_ITERATIONS ? MAX_ITERATIONS : n;
+}
+
+static RunResult runReused(const CorpusLine *line, size_t iterations) {
+    RunResult    r     = {0, 0, 0};
+    CommandLine *cline = InitCommandLine();
+    if (cline == NULL) {
+        return r;
+    }
+    ParseCommandLine(line->text, cline);  // warm-up: grows the arena and arrays once
+
+    size_t before = alloc_count;
+    double start  = nowSec();
+    for (size_t i = 0; i < iterations; i++) {
+        r.failures += ParseCommandLine(line->text, cline) != OK;
+    }
+    r.seconds = nowSec() - start;
+    r.allocs  = alloc_count - before;
+
+    FreeCommandLine(cline);
+    return r;
+}
+
+static RunResult runFresh(const CorpusLine *line, size_t iterations) {
+    RunResult r = {0, 0, 0};
+
+    size_t before = alloc_count;
+    double start  = nowSec();
+    for (size_t i = 0; i < iterations; i++) {
+        CommandLine *cline = InitCommandLine();
+        r.failures += cline == NULL || ParseCommandLine(line->text, cline) != OK;
+        FreeCommandLine(cline);
+    }
+    r.seconds = nowSec() - start;
+    r.allocs  = alloc_count - before;
+    return r;
+}
+
+static void report(const char *mode, const CorpusLine *line, size_t iterations, RunResult r) {
+    double secs = r.seconds > 0 ? r.seconds : 1e-9;
+    printf("%-16s %-7s %10zu %10zu %14.0f %12.1f %10.2f %s\n",
+           line->name, mode, line->len, iterations,
+           (double)iterations / secs,
+           (double)line->len * (double)iterations / secs / (1024.0 * 1024.0),
+           (double)r.allocs / (double)iterations,
+           r.failures == 0 ? "ok" : r.failures == iterations ? "error" : "mixed");
+}
+
+int main(int argc, char *argv[]) {
+    const char *extra_dir  = NULL;
+    const char *seed_dir   = NULL;
+    const char *only       = NULL;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "d:w:n:")) != -1) {
+        switch (opt) {
+            case 'd': extra_dir = optarg; break;
+            case 'w': seed_dir  = optarg; break;
+            case 'n': only      = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-d extra_corpus_dir] [-w write_seeds_dir] [-n name_prefix]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    Corpus corpus;
+    if (CorpusBuild(&corpus) != 0 || (extra_dir != NULL && CorpusLoadDir(&corpus, extra_dir) != 0)) {
+        fprintf(stderr, "failed to build the corpus\n");
+        CorpusFree(&corpus);
+        return 1;
+    }
+
+    if (seed_dir != NULL) {
+        int rc = CorpusWriteDir(&corpus, seed_dir);
+        CorpusFree(&corpus);
+        return rc == 0 ? 0 : 1;
+    }
+
+    printf("scanner: %s\n", ScanImplName());
+    printf("%-16s %-7s %10s %10s %14s %12s %10s %s\n",
+           "line", "mode", "bytes", "iters", "lines/s", "MiB/s", "allocs", "result");
+
+    for (size_t i = 0; i < corpus.count; i++) {
+        const CorpusLine *line = &corpus.lines[i];
+        if (only != NULL && strncmp(line->name, only, strlen(only)) != 0) {
+            continue;
+        }
+
+        size_t iterations = iterationsFor(line->len);
+        report("reused", line, iterations, runReused(line, iterations));
+        report("fresh",  line, iterations, runFresh(line, iterations));
+    }
+
+    CorpusFree(&corpus);
+    return 0;
+}
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+
+#include "parse_corpus.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BIG_LINE   (4 * 1024 * 1024)
+#define RANDOM_SEED 0x5eed5eedu
+
+static const char *TYPICAL[] = {
+    "ls\n",
+    "ls -la /usr/include\n",
+    "cat /etc/passwd | grep root | cut -d: -f1\n",
+    "ps aux | sort -k3 -nr | head -n 10\n",
+    "find . -name *.c | xargs wc -l | sort -n | tail -n 5\n",
+    "make -j8 2>&1 | tee build.log\n",
+    "sort < input.txt > output.txt\n",
+    "echo appended >> log.txt\n",
+    "cmd 2>/dev/null\n",
+    "gzip -c big.tar |> ssh host cat > big.tar.gz\n",
+    "time du -sh /var/log\n",
+    "sleep 10 &\n",
+    "parallel -j 4 gzip ::: a b c d\n",
+    "   \t  echo   spaced    out   \t\n",
+    "# only a comment\n",
+    "echo a # trailing comment\n",
+    "\n",
+    "<in cat>out\n",
+    "a|b|c|d|e|f|g|h\n",
+    "cd ..\n",
+    "grep -e 'a b|c' \"x > y\" file\\ name\n",
+    "tr a-z A-Z <<< \"hello there\" | cat <<EOF\n",
+};
+
+static int    addLine   (Corpus *corpus, const char *name, char *text, size_t len);
+static char*  repeatUnit(const char *unit, const char *tail, size_t total, size_t *len);
+static char*  randomLine(uint32_t *state, size_t len);
+static uint32_t nextRandom(uint32_t *state);
+
+static int addLine(Corpus *corpus, const char *name, char *text, size_t len) {
+    if (text == NULL) {
+        return -1;
+    }
+    if (corpus->count == corpus->cap) {
+        size_t      new_cap = corpus->cap == 0 ? 64 : corpus->cap * 2;
+        CorpusLine *lines   = (CorpusLine*)realloc(corpus->lines, new_cap * sizeof(CorpusLine));
+        if (lines == NULL) {
+            free(text);
+            return -1;
+        }
+        corpus->lines = lines;
+        corpus->cap   = new_cap;
+    }
+
+    CorpusLine *line = &corpus->lines[corpus->count++];
+    line->name = strdup(name);
+    line->text = text;
+    line->len  = len;
+    return 0;
+}
+
+// `unit` repeated up to about `total` bytes, then `tail` and a newline
+static char* repeatUnit(const char *unit, const char *tail, size_t total, size_t *len) {
+    size_t unit_len = strlen(unit);
+    size_t tail_len = strlen(tail);
+    size_t count    = total / unit_len > 0 ? total / unit_len : 1;
+    char  *text     = (char*)malloc(count * unit_len + tail_len + 2);
+    if (text == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        memcpy(text + i * unit_len, unit, unit_len);
+    }
+    memcpy(text + count * unit_len, tail, tail_len);
+    *len = count * unit_len + tail_len;
+    text[(*len)++] = '\n';
+    text[*len]     = '\0';
+    return text;
+}
+
+static uint32_t nextRandom(uint32_t *state) {
+    *state ^= *state << 13;   // xorshift32: reproducible without touching rand()'s state
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Biased towards the bytes the scanner treats specially
+static char* randomLine(uint32_t *state, size_t len) {
+    static const char ALPHABET[] = "ab|||>><<&&  \t'\"#12-";
+    char *text = (char*)malloc(len + 1);
+    if (text == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < len; i++) {
+        text[i] = ALPHABET[nextRandom(state) % (sizeof(ALPHABET) - 1)];
+    }
+    text[len] = '\0';
+    return text;
+}
+
+int CorpusBuild(Corpus *corpus) {
+    memset(corpus, 0, sizeof(*corpus));
+
+    for (size_t i = 0; i < sizeof(TYPICAL) / sizeof(TYPICAL[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "typical-%02zu", i);
+        if (addLine(corpus, name, strdup(TYPICAL[i]), strlen(TYPICAL[i])) != 0) {
+            return -1;
+        }
+    }
+
+    static const struct {
+        const char *name;
+        const char *unit;
+        const char *tail;
+        size_t     size;
+    } GENERATED[] = {
+        {"pipes-64k",      "cat | ",        "cat", 64 * 1024  },
+        {"pipes-4m",       "tr a b | ",     "cat", BIG_LINE   },
+        {"args-4m",        "word ",         "",    BIG_LINE   },
+        {"one-word-4m",    "x",             "",    BIG_LINE   },
+        {"spaces-4m",      " \t",           "",    BIG_LINE   },
+        {"redirs-1m",      "a >f 2>&1 <g ", "",    1024 * 1024},
+        {"buffered-1m",    "cat |> ",       "cat", 1024 * 1024},
+        {"straddle-64k",   "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghij| ", "z", 64 * 1024},
+        {"bare-pipes-64k", "|",             "",    64 * 1024  },  // a syntax error, found late
+    };
+
+    for (size_t i = 0; i < sizeof(GENERATED) / sizeof(GENERATED[0]); i++) {
+        size_t len  = 0;
+        char  *text = repeatUnit(GENERATED[i].unit, GENERATED[i].tail, GENERATED[i].size, &len);
+        if (addLine(corpus, GENERATED[i].name, text, len) != 0) {
+            return -1;
+        }
+    }
+
+    uint32_t state = RANDOM_SEED;
+    for (size_t i = 0; i < 16; i++) {
+        char   name[32];
+        size_t len = 1 + nextRandom(&state) % 4096;
+        snprintf(name, sizeof(name), "random-%02zu", i);
+        if (addLine(corpus, name, randomLine(&state, len), len) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Extra lines, e.g. a libFuzzer corpus directory: one file is one line
+int CorpusLoadDir(Corpus *corpus, const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return -1;
+    }
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        int fd = openat(dirfd(d), entry->d_name, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            if (fd != -1) {
+                close(fd);
+            }
+            continue;
+        }
+
+        size_t  len  = (size_t)st.st_size;
+        char   *text = (char*)malloc(len + 1);
+        ssize_t got  = text != NULL ? read(fd, text, len) : -1;
+        close(fd);
+        if (got < 0) {
+            free(text);
+            continue;
+        }
+        text[got] = '\0';
+        if (addLine(corpus, entry->d_name, text, strlen(text)) != 0) {
+            closedir(d);
+            return -1;
+        }
+    }
+
+    closedir(d);
+    return 0;
+}
+
+// Seeds for a libFuzzer run: 'parse_fuzz corpus_dir' starts from the same lines
+int CorpusWriteDir(const Corpus *corpus, const char *dir) {
+    mkdir(dir, 0777);
+
+    for (size_t i = 0; i < corpus->count; i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, corpus->lines[i].name);
+
+        FILE *f = fopen(path, "we");
+        if (f == NULL) {
+            return -1;
+        }
+        fwrite(corpus->lines[i].text, 1, corpus->lines[i].len, f);
+        fclose(f);
+    }
+    return 0;
+}
+
+void CorpusFree(Corpus *corpus) {
+    for (size_t i = 0; i < corpus->count; i++) {
+        free(corpus->lines[i].name);
+        free(corpus->lines[i].text);
+    }
+    free(corpus->lines);
+    memset(corpus, 0, sizeof(*corpus));
+}
@@ -0,0 +1,25 @@
+#ifndef PARSE_CORPUS_H
+#define PARSE_CORPUS_H
+
+#include <stddef.h>
+
+// Input lines shared by the parser benchmark and the fuzz harness: typical interactive
+// lines plus generated worst cases, from a few bytes up to several MiB.
+typedef struct {
+    char   *name;
+    char   *text;   // NUL-terminated, as ReadCmd() hands it to the parser
+    size_t len;
+} CorpusLine;
+
+typedef struct {
+    CorpusLine *lines;
+    size_t     count;
+    size_t     cap;
+} Corpus;
+
+int  CorpusBuild   (Corpus *corpus);
+int  CorpusLoadDir (Corpus *corpus, const char *dir);
+int  CorpusWriteDir(const Corpus *corpus, const char *dir);
+void CorpusFree    (Corpus *corpus);
+
+#endif // PARSE_CORPUS_H
@@ -0,0 +1,314 @@
+// Fuzz harness for ParseCommandLine(). With clang it is a libFuzzer target
+// (make fuzz CC=clang FUZZ_FLAGS=-fsanitize=fuzzer,address); without libFuzzer the
+// built-in driver runs the shared corpus plus seeded byte-level mutations of it.
+// Run it with SHELL_SCAN=scalar|sse2|avx2 to cover each scanner. Lines that stay inside the
+// grammar of the original strtok_r() parser are also parsed by that one (legacy_parser.c),
+// and both must give the same commands. The driver first checks a few lines with known answers.
+
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "command_parser.h"
+#include "legacy_parser.h"
+#include "parse_corpus.h"
+
+#include <ctype.h>
+#include <stdint.h>
+
+#define MUTATIONS_PER_LINE 2000
+#define MAX_MUTATED_LEN    4096
+
+static void checkLine (const CommandLine *cline, const char *input);
+static void checkSame (const CommandLine *a, const CommandLine *b);
+static int  inLegacyGrammar(const char *input);
+static int  legacyWellFormed(const LegacyLine *old);
+static void checkLegacy(const CommandLine *cline, CmdError err, const char *input);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Properties every successful parse must have, whatever the input
+static void checkLine(const CommandLine *cline, const char *input) {
+    for (size_t i = 0; i < cline->cmd_count; i++) {
+        const Command *cmd = &cline->cmds[i];
+        if (cmd->argc == 0 || cmd->argv == NULL || cmd->argv[cmd->argc] != NULL) {
+            abort();
+        }
+        // Words may be empty now, but only when quoted: "" is an argument of its own
+        for (size_t j = 0; j < cmd->argc; j++) {
+            if (cmd->argv[j] == NULL || (cmd->argv[j][0] == '\0' && strpbrk(input, "'\"\\") == NULL)) {
+                abort();
+            }
+        }
+        for (size_t j = 0; j < cmd->redir_count; j++) {
+            const Redirect *r = &cmd->redirs[j];
+            if (r->fd < 0 || (r->kind != REDIR_DUP && r->target == NULL)) {
+                abort();
+            }
+        }
+        if (cmd->buffer_out && i + 1 == cline->cmd_count) {
+            abort();   // '|>' needs a stage to feed
+        }
+    }
+}
+
+// A recycled CommandLine must give exactly what a fresh one gives
+static void checkSame(const CommandLine *a, const CommandLine *b) {
+    if (a->cmd_count != b->cmd_count || a->background != b->background || a->timed != b->timed) {
+        abort();
+    }
+    for (size_t i = 0; i < a->cmd_count; i++) {
+        const Command *x = &a->cmds[i];
+        const Command *y = &b->cmds[i];
+        if (x->argc != y->argc || x->redir_count != y->redir_count || x->buffer_out != y->buffer_out) {
+            abort();
+        }
+        for (size_t j = 0; j < x->argc; j++) {
+            if (strcmp(x->argv[j], y->argv[j]) != 0) {
+                abort();
+            }
+        }
+        for (size_t j = 0; j < x->redir_count; j++) {
+            const Redirect *p = &x->redirs[j];
+            const Redirect *q = &y->redirs[j];
+            if (p->kind != q->kind || p->fd != q->fd || p->target_fd != q->target_fd ||
+                (p->target != NULL) != (q->target != NULL) ||
+                (p->target != NULL && strcmp(p->target, q->target) != 0)) {
+                abort();
+            }
+        }
+    }
+}
+
+// Plain words and '|' only: quotes, redirections, '&', '#', '$', '=', globs and the 'time'
+// keyword mean something to the current parser that the old one never knew about
+static int inLegacyGrammar(const char *input) {
+    static const char PLAIN[] = " \t\n|/.,:_+-%@^";
+    for (const char *p = input; *p != '\0'; p++) {
+        if (!isalnum((unsigned char)*p) && strchr(PLAIN, *p) == NULL) {
+            return 0;
+        }
+    }
+    const char *word = input + strspn(input, " \t\n");
+    return strncmp(word, "time", 4) != 0 || strchr(" \t\n|", word[4]) == NULL;
+}
+
+// The old parser's own bugs are not the reference: a second '|' inside one word stayed part of
+// an argument, an empty stage ('a | | b', '| a') became a command without argv, and a trailing
+// '|' opened a stage that was then dropped
+static int legacyWellFormed(const LegacyLine *old) {
+    if (old->cmd_count > 0 && old->cmd_count < LEGACY_MAX_COMMANDS && old->cmds[old->cmd_count].argv != NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < old->cmd_count; i++) {
+        if (old->cmds[i].argc == 0) {
+            return 0;
+        }
+        for (size_t j = 0; j < old->cmds[i].argc; j++) {
+            if (strchr(old->cmds[i].argv[j], '|') != NULL) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// What the old parser accepted and got right must come out of the new one word for word
+static void checkLegacy(const CommandLine *cline, CmdError err, const char *input) {
+    if (!inLegacyGrammar(input)) {
+        return;
+    }
+
+    LegacyLine old;
+    memset(&old, 0, sizeof(old));
+    if (LegacyParse(input, &old) == OK && legacyWellFormed(&old)) {
+        if (err != OK || cline->cmd_count != old.cmd_count) {
+            abort();
+        }
+        for (size_t i = 0; i < old.cmd_count; i++) {
+            const Command *cmd = &cline->cmds[i];
+            if (cmd->argc != old.cmds[i].argc || cmd->assign_count != 0 || cmd->redir_count != 0) {
+                abort();
+            }
+            for (size_t j = 0; j < cmd->argc; j++) {
+                if (strcmp(cmd->argv[j], old.cmds[i].argv[j]) != 0) {
+                    abort();
+                }
+            }
+        }
+    }
+    LegacyFree(&old);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static CommandLine *reused = NULL;
+    if (reused == NULL) {
+        reused = InitCommandLine();
+    }
+
+    char *input = (char*)malloc(size + 1);
+    if (input == NULL || reused == NULL) {
+        free(input);
+        return 0;
+    }
+    memcpy(input, data, size);
+    input[size] = '\0';
+
+    CommandLine *fresh = InitCommandLine();
+    if (fresh == NULL) {
+        free(input);
+        return 0;
+    }
+
+    CmdError err_fresh  = ParseCommandLine(input, fresh);
+    CmdError err_reused = ParseCommandLine(input, reused);
+    if (err_fresh != err_reused) {
+        abort();
+    }
+    if (err_fresh == OK) {
+        checkLine(fresh, input);
+        checkSame(fresh, reused);
+    }
+    checkLegacy(fresh, err_fresh, input);
+
+    FreeCommandLine(fresh);
+    free(input);
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+typedef struct {
+    const char *input;
+    const char *words;    // argv of every command joined with ' ', commands with " | "; NULL: any
+    int        dynamic;
+    int        background;
+} KnownLine;
+
+// Lines whose parse is pinned down, not just consistent
+static const KnownLine KNOWN[] = {
+    // '[' is a glob only when a ']' closes it in the same word: 'test' spelled '[' must
+    // neither read the directory nor keep the line out of the plan cache
+    {"[ -f a ]",          "[ -f a ]",          0, 0},
+    {"[ -d x -a -f y ]",  "[ -d x -a -f y ]",  0, 0},
+    {"echo a[b",          "echo a[b",          0, 0},
+    {"echo [ab]",         NULL,                1, 0},
+    {"echo *",            NULL,                1, 0},
+    // '#' starts a comment only at the start of a word, as for the '#!' line of a -f script
+    {"#!/bin/sh -e",      "",                  0, 0},
+    {"echo a#b",          "echo a#b",          0, 0},
+    {"echo a #b c",       "echo a",            0, 0},
+    {"echo a | wc #-l",   "echo a | wc",       0, 0},
+    {"echo '#' \\#x",     "echo # #x",         0, 0},
+    {"echo \"a #b\"",     "echo a #b",         0, 0},
+    // ... and a '&' in the comment does not send the line to the background
+    {"sleep 1 # note &",  "sleep 1",           0, 0},
+    {"sleep 1 & # note",  "sleep 1",           0, 1},
+};
+
+static uint32_t nextRandom(uint32_t *state);
+static int      checkKnown();
+
+static int checkKnown() {
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(KNOWN) / sizeof(KNOWN[0]); i++) {
+        const KnownLine *k = &KNOWN[i];
+        CommandLine *cline = InitCommandLine();
+        if (cline == NULL) {
+            return 1;
+        }
+
+        char   words[256] = "";
+        size_t len        = 0;
+        CmdError err = ParseCommandLine(k->input, cline);
+        for (size_t c = 0; err == OK && c < cline->cmd_count; c++) {
+            for (size_t j = 0; j < cline->cmds[c].argc; j++) {
+                len += (size_t)snprintf(words + len, sizeof(words) - len, "%s%s",
+                                        c > 0 && j == 0 ? " | " : j > 0 ? " " : "",
+                                        cline->cmds[c].argv[j]);
+                len  = len < sizeof(words) ? len : sizeof(words) - 1;
+            }
+        }
+
+        // No listing cache means GlobExpand() never ran, so no getdents64() either
+        int dynamic_ok = k->dynamic ? cline->dynamic : !cline->dynamic && cline->globs == NULL;
+        if (err != OK || !dynamic_ok || cline->background != k->background ||
+            (k->words != NULL && strcmp(words, k->words) != 0)) {
+            fprintf(stderr, "known line '%s': got '%s', dynamic %d, background %d\n",
+                    k->input, words, cline->dynamic, cline->background);
+            failed = 1;
+        }
+        FreeCommandLine(cline);
+    }
+    return failed;
+}
+
+static uint32_t nextRandom(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+int main(int argc, char *argv[]) {
+    Corpus corpus;
+    if (CorpusBuild(&corpus) != 0 || (argc > 1 && CorpusLoadDir(&corpus, argv[1]) != 0)) {
+        fprintf(stderr, "failed to build the corpus\n");
+        CorpusFree(&corpus);
+        return 1;
+    }
+
+    if (checkKnown() != 0) {
+        CorpusFree(&corpus);
+        return 1;
+    }
+
+    static const char INTERESTING[] = "|>< \t\n&#'\"\\2a";
+    uint8_t  *buf   = (uint8_t*)malloc(MAX_MUTATED_LEN);
+    uint32_t state  = 0x1234567u;
+    size_t   inputs = 0;
+
+    for (size_t i = 0; i < corpus.count && buf != NULL; i++) {
+        const CorpusLine *line = &corpus.lines[i];
+        LLVMFuzzerTestOneInput((const uint8_t*)line->text, line->len);
+        inputs++;
+
+        // Small lines only: the big ones would make every mutation as slow as a benchmark run
+        if (line->len > MAX_MUTATED_LEN) {
+            continue;
+        }
+        for (size_t m = 0; m < MUTATIONS_PER_LINE; m++) {
+            size_t len = line->len;
+            memcpy(buf, line->text, len);
+
+            size_t edits = 1 + nextRandom(&state) % 4;
+            for (size_t e = 0; e < edits && len > 0; e++) {
+                size_t pos = nextRandom(&state) % len;
+                switch (nextRandom(&state) % 3) {
+                    case 0:   // overwrite
+                        buf[pos] = (uint8_t)INTERESTING[nextRandom(&state) % (sizeof(INTERESTING) - 1)];
+                        break;
+                    case 1:   // delete
+                        memmove(buf + pos, buf + pos + 1, len - pos - 1);
+                        len--;
+                        break;
+                    default:  // insert
+                        if (len < MAX_MUTATED_LEN) {
+                            memmove(buf + pos + 1, buf + pos, len - pos);
+                            buf[pos] = (uint8_t)INTERESTING[nextRandom(&state) % (sizeof(INTERESTING) - 1)];
+                            len++;
+                        }
+                        break;
+                }
+            }
+            LLVMFuzzerTestOneInput(buf, len);
+            inputs++;
+        }
+    }
+
+    printf("%zu inputs, no failures\n", inputs);
+    free(buf);
+    CorpusFree(&corpus);
+    return 0;
+}
+
+#endif // FUZZ_LIBFUZZER
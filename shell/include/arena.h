@@ -0,0 +1,24 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_DEFAULT_BLOCK (64 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+// Bump allocator: memory is handed out linearly and released all at once.
+// Pointers stay valid until ArenaReset()/ArenaFree(), blocks are never moved.
+typedef struct {
+    ArenaBlock *head;      // block currently being filled
+    size_t      capacity;  // total bytes over all blocks
+    size_t      min_block; // smallest block to allocate
+} Arena;
+
+void  ArenaInit (Arena *arena, size_t min_block);
+void* ArenaAlloc(Arena *arena, size_t size, size_t align);
+char* ArenaStrndup(Arena *arena, const char *str, size_t len);
+void  ArenaReset(Arena *arena);
+void  ArenaFree (Arena *arena);
+
+#endif // ARENA_H
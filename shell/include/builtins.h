@@ -0,0 +1,18 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "command_parser.h"
+
+typedef int (*BuiltinFn)(Command *cmd);
+
+typedef struct {
+    const char *name;
+    BuiltinFn  fn;
+} Builtin;
+
+// Builtins run inside the shell when they make up the whole line, and in a forked
+// child without exec when they are one stage of a pipeline.
+const Builtin* FindBuiltin(const char *name);
+int            ShellExitRequested(int *code);
+
+#endif // BUILTINS_H
@@ -1,22 +1,68 @@
 #ifndef COMMAND_PARSER_H
 #define COMMAND_PARSER_H
 
+#include "arena.h"
 #include "common.h"
+#include "glob_expand.h"
+
+#include <sys/types.h>
+
+typedef enum RedirKind
+{
+    REDIR_IN         = 0x0000,  // fd< target
+    REDIR_OUT        = 0x0001,  // fd> target
+    REDIR_APPEND     = 0x0002,  // fd>> target
+    REDIR_DUP        = 0x0003,  // fd>&target_fd
+    REDIR_HEREDOC    = 0x0004,  // fd<<WORD, target is the body once it has been read
+    REDIR_HERESTRING = 0x0005,  // fd<<<word, the body is target plus a newline
+} RedirKind;
+
+typedef struct {
+    RedirKind  kind;
+    int        fd;          // descriptor being redirected
+    char       *target;     // file name, in the arena
+    int        target_fd;   // REDIR_DUP, and the body's memfd or pipe while a stage starts
+    int        expand;      // heredoc delimiter was unquoted: $references in the body expand
+} Redirect;
 
 typedef struct {
-    char    **argv;
-    size_t  argc;
+    char     **argv;        // NULL-terminated slice of CommandLine.slots, entries point into arena
+    size_t   argc;
+    char     **assigns;     // leading 'NAME=value' words, in the slots right before argv
+    size_t   assign_count;
+    int      buffer_out;    // joined to the next command by '|>' instead of '|'
+    Redirect *redirs;       // applied in order, after the pipe ends are in place
+    size_t   redir_count;
 } Command;
 
 typedef struct {
     Command  *cmds;
     size_t   cmd_count;
+    size_t   cmd_cap;
+    char     **slots;     // argv arrays of all commands back to back, grown on demand
+    size_t   slot_count;
+    size_t   slot_cap;
+    Redirect *redirs;     // redirections of all commands back to back
+    size_t   redir_total;
+    size_t   redir_cap;
+    int      background;  // line ended with '&'
+    int      timed;       // line started with the 'time' keyword
+    int      dynamic;     // has globs, $variables or heredocs, so the parse is only good for this run
+    size_t   heredocs;    // '<<' redirections whose body still has to be read
+    GlobCache *globs;     // directory listings read for this line, in the arena
+    Arena    arena;       // owns the tokenized copy of the input
 } CommandLine;
 
 CommandLine* InitCommandLine();
+CommandLine* InitCommandLineSized(size_t arena_block);
 CmdError     ParseCommandLine(const char *input, CommandLine *out);
+void         ResetCommandLine(CommandLine *line);
 void         FreeCommandLine(CommandLine *line);
-char*        ReadCmd();
+ssize_t      ReadCmd(char **buf, size_t *cap);
+CmdError     ReadCmdHeredocs(CommandLine *cline);
+void         ReadCmdInit(int fd, int interactive);
+CmdError     ReadCmdInitString(const char *text);
+void         ReadCmdFree();
 void         PrintCommandLineTable(CommandLine *cline);
 
 #endif //COMMAND_PARSER_H
@@ -19,8 +19,6 @@ typedef enum CmdError
     OK                  = 0x0000,  
     ALLOC_ERR           = 0x0001,  
     READ_ERR            = 0x0002,  
-    TOO_MANY_COMMANDS   = 0x0003,  
-    TOO_MANY_ARGS       = 0x0004,  
     SYNTAX_ERR          = 0x0005,
     NULL_PTR            = 0x0006,
 } CmdError;
@@ -0,0 +1,17 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "common.h"
+
+// Command names for tab completion: a compressed trie of every executable on $PATH,
+// built once and then kept current from inotify events on the PATH directories, which
+// are drained on each completion request instead of rescanning anything.
+CmdError CompletionInit();
+void     CompletionFree();
+size_t   CompletionExtend(const char *prefix, size_t len, char *out, size_t out_cap, size_t *matches);
+void     CompletionList  (const char *prefix, size_t len, FILE *out);
+
+#endif // COMPLETION_H
@@ -0,0 +1,18 @@
+#ifndef GLOB_EXPAND_H
+#define GLOB_EXPAND_H
+
+#include "arena.h"
+#include "common.h"
+
+typedef struct GlobCache GlobCache;
+
+typedef CmdError (*GlobEmit)(void *ctx, char *path);
+
+// '*', '?', '[...]' and a whole '**' component (any depth of subdirectories).
+// Directory listings are read once with getdents64() and kept in the arena, so every
+// pattern of one command line shares them; the cache goes away with the arena.
+int      GlobHasMeta(const char *word);
+CmdError GlobExpand (Arena *arena, GlobCache **cache, const char *pattern,
+                     GlobEmit emit, void *ctx, size_t *count);
+
+#endif // GLOB_EXPAND_H
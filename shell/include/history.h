@@ -0,0 +1,20 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <sys/types.h>
+
+#include "command_parser.h"
+
+#define HISTORY_FILE ".shell_history"   // in $HOME unless $HISTFILE is set
+
+// One line per entry in an append-only file that several shells may share: every entry
+// goes in with a single O_APPEND write, and the file is read through mmap(), so opening
+// costs the same however long it is. Searches go through a trigram index that is built
+// on the first search and then extended with every line appended by any shell.
+CmdError    HistoryOpen (int create);
+void        HistoryAdd  (const char *line, size_t len);
+const char* HistoryFind (const char *needle, size_t before, size_t *len, size_t *pos);
+void        HistoryClose();
+int         HistoryBuiltin(Command *cmd);
+
+#endif // HISTORY_H
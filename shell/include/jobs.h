@@ -0,0 +1,32 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+
+#include "command_parser.h"
+#include "timing.h"
+
+typedef struct Job Job;
+
+// Children are reaped through pidfds in one epoll set, together with the shell's input,
+// and only by pid: a job never collects a child that belongs to another job.
+CmdError JobsInit(int interactive);
+void     JobsShutdown();
+void     JobsAfterFork();
+
+Job*     JobCreate (CommandLine *cline);
+void     JobStageStarting(Job *job, size_t stage);
+void     JobAddPid (Job *job, size_t stage, pid_t pid);
+int      JobWait   (Job *job);
+size_t   JobWaitAny(Job **jobs, size_t count, int *status);
+void     JobDetach (Job *job);
+void     JobRelease(Job *job);
+
+const StageTiming* JobStages(Job *job, size_t *count);
+void     JobsNotify();
+int      JobsWaitInput(int fd);
+
+int      JobsBuiltin(Command *cmd);
+int      WaitBuiltin(Command *cmd);
+
+#endif // JOBS_H
@@ -0,0 +1,39 @@
+#ifndef LAUNCHER_H
+#define LAUNCHER_H
+
+#include <sys/types.h>
+
+#include "builtins.h"
+#include "command_parser.h"
+
+typedef enum LaunchMode
+{
+    LAUNCH_FORK  = 0x0000,
+    LAUNCH_VFORK = 0x0001,  // vfork(): parent sleeps until exec, no page table copy
+    LAUNCH_CLONE = 0x0002,  // clone(CLONE_VM | CLONE_VFORK) on a private child stack
+    LAUNCH_SPAWN = 0x0003,  // posix_spawn() with file actions
+} LaunchMode;
+
+typedef struct {
+    int in_fd;     // becomes stdin of the stage, -1 to inherit
+    int out_fd;    // becomes stdout of the stage, -1 to inherit
+    int close_fd;  // read end of the stage's own pipe, must not leak into the child
+} StageIo;
+
+typedef struct {
+    int fd;
+    int saved;   // parked copy of fd, -1 if fd was closed
+} SavedFd;
+
+pid_t       LaunchStage    (LaunchMode mode, const char *path, Command *cmd, char **envp,
+                            const StageIo *io);
+pid_t       LaunchBuiltin  (const Builtin *builtin, Command *cmd, const StageIo *io);
+pid_t       LaunchPipeBuffer(size_t capacity, const StageIo *io);
+CmdError    OpenHereDocs   (Command *cmd);
+void        CloseHereDocs  (Command *cmd);
+CmdError    RedirectShell  (const Command *cmd, SavedFd **saved, size_t *nsaved);
+void        RestoreShell   (SavedFd *saved, size_t nsaved);
+CmdError    ParseLaunchMode(const char *name, LaunchMode *mode);
+const char* LaunchModeName (LaunchMode mode);
+
+#endif // LAUNCHER_H
@@ -0,0 +1,13 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "command_parser.h"
+#include "run_cmd.h"
+
+// 'parallel [-j N] cmd [args...] ::: a b c' runs cmd once per input, at most N at a time.
+// '{}' in the template is replaced by the input, otherwise the input is appended.
+// Each job's stdout is collected and written out in one piece when the job is done.
+void ParallelInit   (const RunOptions *opts);
+int  ParallelBuiltin(Command *cmd);
+
+#endif // PARALLEL_H
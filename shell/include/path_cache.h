@@ -0,0 +1,14 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include "command_parser.h"
+
+// Remembers where each command name was found on $PATH, so stages can be started with
+// execve() instead of letting execvp() probe every directory. The table is dropped
+// whenever $PATH has been assigned or unset since it was built.
+const char* PathCacheLookup(const char *name);
+void        PathCacheForget(const char *name);
+void        PathCacheClear();
+int         HashBuiltin(Command *cmd);
+
+#endif // PATH_CACHE_H
@@ -0,0 +1,18 @@
+#ifndef PIPE_BUFFER_H
+#define PIPE_BUFFER_H
+
+#include <stddef.h>
+
+#include "common.h"
+
+#define PIPE_BUFFER_DEFAULT (16 * 1024 * 1024)
+
+// Capacity of inter-stage pipes (F_SETPIPE_SZ); unprivileged users are capped at
+// /proc/sys/fs/pipe-max-size.
+CmdError SetPipeSize(int fd, size_t size);
+
+// Body of a '|>' stage: moves everything from in_fd to out_fd with splice(), holding up to
+// `capacity` bytes in a ring of internal pipes so the producer never waits on the consumer.
+int      PumpPipeBuffer(int in_fd, int out_fd, size_t capacity);
+
+#endif // PIPE_BUFFER_H
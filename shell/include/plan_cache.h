@@ -0,0 +1,14 @@
+#ifndef PLAN_CACHE_H
+#define PLAN_CACHE_H
+
+#include "command_parser.h"
+
+#define PLAN_CACHE_DEFAULT 1024
+
+// Parsed CommandLines keyed by the text of the line. A repeated line is run from its
+// cached plan without being parsed again; a direct-mapped table keeps lookups O(1).
+CmdError PlanCacheInit(size_t capacity);
+CmdError PlanCacheGet (const char *line, size_t len, CommandLine **plan);
+void     PlanCacheFree();
+
+#endif // PLAN_CACHE_H
@@ -2,7 +2,18 @@
 #define RUN_CMD_H
 
 #include "command_parser.h"
+#include "jobs.h"
+#include "launcher.h"
 
-void RunCmd(CommandLine *cline);
+typedef struct {
+    LaunchMode launcher;
+    int        timing;       // report every pipeline as if prefixed with 'time'
+    FILE       *timing_log;  // if set, one JSON line per timed pipeline goes here
+    size_t     pipe_size;    // F_SETPIPE_SZ for every inter-stage pipe, 0 keeps the default
+    size_t     buffer_size;  // bytes held by each '|>' stage
+} RunOptions;
+
+int  RunCmd(CommandLine *cline, const RunOptions *opts);
+Job* StartPipeline(CommandLine *cline, const RunOptions *opts, int out_fd);
 
 #endif // RUN_CMD_H
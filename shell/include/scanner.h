@@ -0,0 +1,20 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <stdint.h>
+
+#define SCAN_BLOCK   64
+#define SCAN_PADDING SCAN_BLOCK   // zero bytes the caller keeps after the input for whole-block loads
+
+// Bit i of each mask describes byte i of a 64-byte block.
+typedef struct {
+    uint64_t space;   // ' ', '\t', '\n'
+    uint64_t pipe;    // '|'
+    uint64_t quote;   // '\'', '"', '\\'
+    uint64_t redir;   // '<', '>'
+} ScanMasks;
+
+void        ScanBlock(const char *block, ScanMasks *masks);
+const char* ScanImplName();
+
+#endif // SCANNER_H
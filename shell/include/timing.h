@@ -0,0 +1,24 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+
+// What one pipeline stage cost: monotonic start/end and the rusage from wait4().
+typedef struct {
+    const char      *name;
+    pid_t           pid;      // -1 if the stage ran inside the shell or never started
+    int             status;
+    struct timespec start;
+    struct timespec end;
+    struct rusage   usage;
+} StageTiming;
+
+void TimingNow         (struct timespec *ts);
+void TimingSelfDelta   (const struct rusage *before, struct rusage *delta);
+void PrintTiming       (FILE *out, const StageTiming *stages, size_t count);
+void PrintTimingRecord (FILE *out, const StageTiming *stages, size_t count);
+
+#endif // TIMING_H
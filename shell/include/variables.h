@@ -0,0 +1,32 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include "arena.h"
+#include "command_parser.h"
+
+#include <stdint.h>
+
+#define VAR_KEEP_EXPORT -1   // VarSet(): leave the export flag as it is
+
+// Shell variables in one open-addressing table; exported ones make up the environment
+// of every launched program. That envp array is rebuilt only after an exported variable
+// changes, and otherwise handed to execve()/posix_spawn() as it is.
+CmdError    VarsInit     (char **envp);
+void        VarsFree     ();
+const char* VarGet       (const char *name);
+uint64_t    VarsPathGeneration();
+CmdError    VarSet       (const char *name, size_t name_len, const char *value, int exported);
+void        VarUnset     (const char *name);
+void        VarsSetStatus(int status);
+
+int         VarIsAssignment(const char *word);
+CmdError    VarsRef      (const char *p, size_t *used, const char **value);
+CmdError    VarsExpand   (Arena *arena, const char *word, char **out);
+char**      VarsEnviron  ();
+char**      VarsEnvironWith(char **assigns, size_t count);
+void        VarsApply    (char **assigns, size_t count, int exported);
+
+int         ExportBuiltin(Command *cmd);
+int         UnsetBuiltin (Command *cmd);
+
+#endif // VARIABLES_H
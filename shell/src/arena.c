@@ -0,0 +1,117 @@
+#include "arena.h"
+#include "common.h"
+
+#include <stdint.h>
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t      size;
+    size_t      used;
+    char        data[];
+};
+
+static ArenaBlock* newBlock(size_t size);
+
+void ArenaInit(Arena *arena, size_t min_block) {
+    assert(arena);
+
+    arena->head      = NULL;
+    arena->capacity  = 0;
+    arena->min_block = min_block;
+}
+
+static ArenaBlock* newBlock(size_t size) {
+    ArenaBlock *block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void* ArenaAlloc(Arena *arena, size_t size, size_t align) {
+    assert(arena);
+    assert(align != 0 && (align & (align - 1)) == 0);
+
+    ArenaBlock *block = arena->head;
+    if (block != NULL) {
+        uintptr_t cur = (uintptr_t)(block->data + block->used);
+        size_t    pad = (size_t)(-cur & (align - 1));
+        if (pad + size <= block->size - block->used) {
+            block->used += pad + size;
+            return (void*)(cur + pad);
+        }
+    }
+
+    size_t want = size + align;
+    if (want < arena->min_block) {
+        want = arena->min_block;
+    }
+    if (want < arena->capacity) {
+        want = arena->capacity;  // double the total on each new block
+    }
+
+    ArenaBlock *fresh = newBlock(want);
+    if (fresh == NULL) {
+        return NULL;
+    }
+    fresh->next      = block;
+    arena->head      = fresh;
+    arena->capacity += want;
+
+    uintptr_t cur = (uintptr_t)fresh->data;
+    size_t    pad = (size_t)(-cur & (align - 1));
+    fresh->used = pad + size;
+    return (void*)(cur + pad);
+}
+
+char* ArenaStrndup(Arena *arena, const char *str, size_t len) {
+    assert(str);
+
+    char *dup = (char*)ArenaAlloc(arena, len + 1, 1);
+    if (dup == NULL) {
+        return NULL;
+    }
+    memcpy(dup, str, len);
+    dup[len] = '\0';
+    return dup;
+}
+
+// O(1) once the arena has settled into a single block. If the last use spilled into
+// several blocks they are merged into one, so the next use of the same size needs none.
+void ArenaReset(Arena *arena) {
+    assert(arena);
+
+    ArenaBlock *block = arena->head;
+    if (block == NULL) {
+        return;
+    }
+
+    if (block->next == NULL) {
+        block->used = 0;
+        return;
+    }
+
+    size_t total = arena->capacity;
+    ArenaFree(arena);
+
+    arena->head = newBlock(total);
+    if (arena->head != NULL) {
+        arena->capacity = total;
+    }
+}
+
+void ArenaFree(Arena *arena) {
+    assert(arena);
+
+    ArenaBlock *block = arena->head;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head     = NULL;
+    arena->capacity = 0;
+}
@@ -0,0 +1,240 @@
+#include "builtins.h"
+#include "common.h"
+#include "history.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "path_cache.h"
+#include "variables.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int exit_requested = 0;
+static int exit_code      = 0;
+
+static int builtinCd   (Command *cmd);
+static int builtinEcho (Command *cmd);
+static int builtinExit (Command *cmd);
+static int builtinFalse(Command *cmd);
+static int builtinPwd  (Command *cmd);
+static int builtinTest (Command *cmd);
+static int builtinTrue (Command *cmd);
+
+static int compareBuiltin(const void *key, const void *elem);
+static int evalTest      (char **argv, size_t argc);
+
+// Sorted by name for bsearch()
+static const Builtin BUILTINS[] = {
+    {":",        builtinTrue    },
+    {"[",        builtinTest    },
+    {"cd",       builtinCd      },
+    {"echo",     builtinEcho    },
+    {"exit",     builtinExit    },
+    {"export",   ExportBuiltin  },
+    {"false",    builtinFalse   },
+    {"hash",     HashBuiltin    },
+    {"history",  HistoryBuiltin },
+    {"jobs",     JobsBuiltin    },
+    {"parallel", ParallelBuiltin},
+    {"pwd",      builtinPwd     },
+    {"test",     builtinTest    },
+    {"true",     builtinTrue    },
+    {"unset",    UnsetBuiltin   },
+    {"wait",     WaitBuiltin    },
+};
+
+static int compareBuiltin(const void *key, const void *elem) {
+    return strcmp((const char*)key, ((const Builtin*)elem)->name);
+}
+
+const Builtin* FindBuiltin(const char *name) {
+    assert(name);
+
+    return (const Builtin*)bsearch(name, BUILTINS, sizeof(BUILTINS) / sizeof(BUILTINS[0]),
+                                   sizeof(Builtin), compareBuiltin);
+}
+
+int ShellExitRequested(int *code) {
+    if (exit_requested && code != NULL) {
+        *code = exit_code;
+    }
+    return exit_requested;
+}
+
+static int builtinTrue(Command *cmd) {
+    (void)cmd;
+    return 0;
+}
+
+static int builtinFalse(Command *cmd) {
+    (void)cmd;
+    return 1;
+}
+
+static int builtinEcho(Command *cmd) {
+    size_t first   = 1;
+    int    newline = 1;
+
+    if (cmd->argc > 1 && strcmp(cmd->argv[1], "-n") == 0) {
+        newline = 0;
+        first   = 2;
+    }
+
+    for (size_t i = first; i < cmd->argc; i++) {
+        if (i > first) {
+            putchar(' ');
+        }
+        fputs(cmd->argv[i], stdout);
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+static int builtinPwd(Command *cmd) {
+    (void)cmd;
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        fprintf(stderr, "shell: pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("%s\n", cwd);
+    return 0;
+}
+
+static int builtinCd(Command *cmd) {
+    const char *dir = cmd->argc > 1 ? cmd->argv[1] : VarGet("HOME");
+
+    if (dir == NULL) {
+        fprintf(stderr, "shell: cd: HOME not set\n");
+        return 1;
+    }
+    if (strcmp(dir, "-") == 0) {
+        dir = VarGet("OLDPWD");
+        if (dir == NULL) {
+            fprintf(stderr, "shell: cd: OLDPWD not set\n");
+            return 1;
+        }
+        printf("%s\n", dir);
+    }
+
+    char old[PATH_MAX];
+    int  have_old = getcwd(old, sizeof(old)) != NULL;
+
+    if (chdir(dir) != 0) {
+        fprintf(stderr, "shell: cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    char cwd[PATH_MAX];
+    if (have_old) {
+        VarSet("OLDPWD", 6, old, 1);
+    }
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        VarSet("PWD", 3, cwd, 1);
+    }
+    return 0;
+}
+
+static int builtinExit(Command *cmd) {
+    int code = 0;
+
+    if (cmd->argc > 1) {
+        char *end = NULL;
+        long  val = strtol(cmd->argv[1], &end, 10);
+        if (*cmd->argv[1] == '\0' || *end != '\0') {
+            fprintf(stderr, "shell: exit: %s: numeric argument required\n", cmd->argv[1]);
+            val = 2;
+        }
+        code = (int)(val & 0xff);
+    }
+
+    exit_requested = 1;
+    exit_code      = code;
+    return code;
+}
+
+// test EXPR / [ EXPR ]: the POSIX forms with up to four arguments
+static int builtinTest(Command *cmd) {
+    size_t argc = cmd->argc;
+
+    if (strcmp(cmd->argv[0], "[") == 0) {
+        if (strcmp(cmd->argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "shell: [: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+
+    return evalTest(cmd->argv + 1, argc - 1);
+}
+
+static int evalTest(char **argv, size_t argc) {
+    if (argc == 0) {
+        return 1;
+    }
+
+    if (strcmp(argv[0], "!") == 0 && argc > 1) {
+        int rc = evalTest(argv + 1, argc - 1);
+        return rc == 2 ? 2 : !rc;
+    }
+
+    if (argc == 1) {
+        return argv[0][0] == '\0';
+    }
+
+    if (argc == 2) {
+        const char *op  = argv[0];
+        const char *arg = argv[1];
+        struct stat st;
+
+        if (strcmp(op, "-n") == 0) return arg[0] == '\0';
+        if (strcmp(op, "-z") == 0) return arg[0] != '\0';
+        if (strcmp(op, "-r") == 0) return access(arg, R_OK) != 0;
+        if (strcmp(op, "-w") == 0) return access(arg, W_OK) != 0;
+        if (strcmp(op, "-x") == 0) return access(arg, X_OK) != 0;
+
+        int found = stat(arg, &st) == 0;
+        if (strcmp(op, "-e") == 0) return !found;
+        if (strcmp(op, "-f") == 0) return !(found && S_ISREG(st.st_mode));
+        if (strcmp(op, "-d") == 0) return !(found && S_ISDIR(st.st_mode));
+        if (strcmp(op, "-s") == 0) return !(found && st.st_size > 0);
+
+        fprintf(stderr, "shell: test: %s: unary operator expected\n", op);
+        return 2;
+    }
+
+    if (argc == 3) {
+        const char *lhs = argv[0];
+        const char *op  = argv[1];
+        const char *rhs = argv[2];
+
+        if (strcmp(op, "=") == 0)  return strcmp(lhs, rhs) != 0;
+        if (strcmp(op, "!=") == 0) return strcmp(lhs, rhs) == 0;
+
+        char *lend = NULL, *rend = NULL;
+        long  l    = strtol(lhs, &lend, 10);
+        long  r    = strtol(rhs, &rend, 10);
+        if (op[0] == '-' && (*lhs == '\0' || *lend != '\0' || *rhs == '\0' || *rend != '\0')) {
+            fprintf(stderr, "shell: test: integer expression expected\n");
+            return 2;
+        }
+
+        if (strcmp(op, "-eq") == 0) return !(l == r);
+        if (strcmp(op, "-ne") == 0) return !(l != r);
+        if (strcmp(op, "-lt") == 0) return !(l <  r);
+        if (strcmp(op, "-le") == 0) return !(l <= r);
+        if (strcmp(op, "-gt") == 0) return !(l >  r);
+        if (strcmp(op, "-ge") == 0) return !(l >= r);
+
+        fprintf(stderr, "shell: test: %s: binary operator expected\n", op);
+        return 2;
+    }
+
+    fprintf(stderr, "shell: test: too many arguments\n");
+    return 2;
+}
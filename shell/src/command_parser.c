@@ -1,189 +1,688 @@
 #include "command_parser.h"
+#include "scanner.h"
+#include "variables.h"
 #include "string.h"
 
 #include <ctype.h>
-
-#define PIPE_SEPARATOR        "|"
-#define ARGUMENT_SEPARATORS   " \t\n"
-
-#define MAX_ARGS     256
-#define MAX_COMMANDS 16
-
-static char*    fixBeforeTok(char *tok, char *pipe_pos);
-static char*    fixAfterTok (char *pipe_pos);
-static CmdError InitCommand (Command *cmd);
+#include <unistd.h>
+
+#define INITIAL_COMMANDS 8
+#define INITIAL_SLOTS    64
+#define NO_PENDING       SIZE_MAX
+
+#define WORD_QUOTED 0x1   // had quotes or backslashes: kept even if it comes out empty
+#define WORD_GLOB   0x2   // has an unquoted '*', '?' or '['
+#define WORD_VARS   0x4   // had a $reference
+
+enum {
+    QUOTE_NONE,
+    QUOTE_SINGLE,
+    QUOTE_DOUBLE,
+    QUOTE_ESCAPE,         // the next byte follows a backslash
+    QUOTE_DOUBLE_ESCAPE,  // same, inside double quotes
+};
+
+// A word once its quotes are gone: value is the argument, pattern the same text for
+// the glob engine with quoted metacharacters backslash-escaped (only built for WORD_GLOB).
+typedef struct {
+    char   *value;
+    char   *pattern;
+    size_t value_len;
+    size_t pattern_len;
+    int    flags;
+} WordOut;
+
+static char NOOP_WORD[] = ":";
+
+static CmdError openCommand (CommandLine *line);
+static CmdError closeCommand(CommandLine *line, size_t pending);
+static CmdError AddArgument (CommandLine *line, char *arg);
+static CmdError pushSlot    (CommandLine *line, char *arg);
+static CmdError pushRedir   (CommandLine *line, const Redirect *redir);
+static CmdError emitWord    (CommandLine *line, char *word, size_t *pending);
+static CmdError addWord     (CommandLine *line, char *tok, int has_redir, size_t *pending);
+static CmdError addGlob     (CommandLine *line, const char *pattern, char *literal);
+static uint64_t quotedBytes (const char *block, uint64_t quotes, int *state);
+static size_t   findComment (const char *buf, size_t len);
+static char*    findOperator(char *p);
+static void     putChar     (WordOut *out, char c, int quoted);
+static CmdError expandWord  (CommandLine *line, const char *word, WordOut *out);
+static CmdError emitMatch   (void *ctx, char *path);
+static int      compareWords(const void *a, const void *b);
 
 CommandLine* InitCommandLine() {
+    return InitCommandLineSized(ARENA_DEFAULT_BLOCK);
+}
+
+// Lines kept around for a long time (the plan cache) use a small arena block.
+CommandLine* InitCommandLineSized(size_t arena_block) {
     CommandLine *line = (CommandLine*)calloc(1, sizeof(CommandLine));
     if (line == NULL) {
         return NULL;
     }
-    line->cmds = (Command*)calloc(MAX_COMMANDS, sizeof(Command));
-    if (line->cmds == NULL) {
+    line->cmds  = (Command*)calloc(INITIAL_COMMANDS, sizeof(Command));
+    line->slots = (char**)calloc(INITIAL_SLOTS, sizeof(char*));
+    if (line->cmds == NULL || line->slots == NULL) {
+        free(line->cmds);
+        free(line->slots);
         free(line);
         return NULL;
     }
-    line->cmd_count = 0;
+    line->cmd_cap  = INITIAL_COMMANDS;
+    line->slot_cap = INITIAL_SLOTS;
+    ArenaInit(&line->arena, arena_block);
     return line;
 }
 
+// Drops the previous parse without touching the allocator, so a REPL can reuse one line.
+void ResetCommandLine(CommandLine *line) {
+    assert(line);
+
+    ArenaReset(&line->arena);
+    line->cmd_count   = 0;
+    line->slot_count  = 0;
+    line->redir_total = 0;
+    line->background  = 0;
+    line->timed       = 0;
+    line->dynamic     = 0;
+    line->heredocs    = 0;
+    line->globs       = NULL;  // it lived in the arena
+}
+
 void FreeCommandLine(CommandLine *line) {
     if (line == NULL) return;
 
-    for (size_t i = 0; i < line->cmd_count; i++) {
-        for (size_t j = 0; j < line->cmds[i].argc; j++) {
-            free(line->cmds[i].argv[j]);
-        }
-        free(line->cmds[i].argv);
-    }
-
+    ArenaFree(&line->arena);
+    free(line->redirs);
+    free(line->slots);
     free(line->cmds);
     free(line);
 }
 
-static CmdError InitCommand(Command *cmd) {
-    assert(cmd);
+static CmdError pushSlot(CommandLine *line, char *arg) {
+    if (line->slot_count == line->slot_cap) {
+        size_t new_cap = line->slot_cap * 2;
+        char **slots = (char**)realloc(line->slots, new_cap * sizeof(char*));
+        if (slots == NULL) {
+            return ALLOC_ERR;
+        }
+        line->slots    = slots;
+        line->slot_cap = new_cap;
+    }
 
-    cmd->argv = (char**)calloc(MAX_ARGS, sizeof(char*));
-    if (cmd->argv == NULL) {
-        return ALLOC_ERR;
+    line->slots[line->slot_count++] = arg;
+    return OK;
+}
+
+// Starts cmds[cmd_count]; its argv is only bound to slots once parsing is done,
+// because slots may still move while it grows.
+static CmdError openCommand(CommandLine *line) {
+    if (line->cmd_count == line->cmd_cap) {
+        size_t new_cap = line->cmd_cap * 2;
+        Command *cmds = (Command*)realloc(line->cmds, new_cap * sizeof(Command));
+        if (cmds == NULL) {
+            return ALLOC_ERR;
+        }
+        line->cmds    = cmds;
+        line->cmd_cap = new_cap;
     }
 
-    cmd->argc = 0;
+    line->cmds[line->cmd_count].argv         = NULL;
+    line->cmds[line->cmd_count].argc         = 0;
+    line->cmds[line->cmd_count].assigns      = NULL;
+    line->cmds[line->cmd_count].assign_count = 0;
+    line->cmds[line->cmd_count].buffer_out   = 0;
+    line->cmds[line->cmd_count].redirs       = NULL;
+    line->cmds[line->cmd_count].redir_count  = 0;
     return OK;
 }
 
-static CmdError AddArgument(Command *cmd, char *arg) {
-    if (cmd->argc >= MAX_ARGS - 1) { 
-        free(arg); 
-        return TOO_MANY_ARGS;
+static CmdError pushRedir(CommandLine *line, const Redirect *redir) {
+    if (line->redir_total == line->redir_cap) {
+        size_t   new_cap = line->redir_cap == 0 ? 8 : line->redir_cap * 2;
+        Redirect *redirs = (Redirect*)realloc(line->redirs, new_cap * sizeof(Redirect));
+        if (redirs == NULL) {
+            return ALLOC_ERR;
+        }
+        line->redirs    = redirs;
+        line->redir_cap = new_cap;
     }
-    cmd->argv[cmd->argc++] = arg; 
+
+    line->redirs[line->redir_total++] = *redir;
+    line->cmds[line->cmd_count].redir_count++;
     return OK;
 }
 
-CmdError ParseCommandLine(const char *input, CommandLine *out) {
-    assert(input);
-    assert(out);
+static void putChar(WordOut *out, char c, int quoted) {
+    int meta = c == '*' || c == '?' || c == '[';
 
-    char* input_copy = strdup(input);
-    if (input_copy == NULL) {
-        return ALLOC_ERR;
+    if (out->value != NULL) {
+        out->value[out->value_len] = c;
     }
+    out->value_len++;
 
-    if (InitCommand(&out->cmds[0]) != OK) {
-        free(input_copy);
-        return ALLOC_ERR;
+    if ((meta && quoted) || c == '\\') {
+        if (out->pattern != NULL) {
+            out->pattern[out->pattern_len] = '\\';
+        }
+        out->pattern_len++;
     }
+    if (out->pattern != NULL) {
+        out->pattern[out->pattern_len] = c;
+    }
+    out->pattern_len++;
 
-    char *save_ptr = NULL;
-    for (char *tok = strtok_r(input_copy, ARGUMENT_SEPARATORS, &save_ptr);
-         tok != NULL;
-         tok = strtok_r(NULL, ARGUMENT_SEPARATORS, &save_ptr))
-    {
-        Command *cur = &out->cmds[out->cmd_count];
-        char *pipe_pos = strchr(tok, '|');
+    if (meta && !quoted) {
+        out->flags |= WORD_GLOB;
+    }
+}
 
-        if (strcmp(tok, PIPE_SEPARATOR) == 0) {
-            out->cmd_count++;
+// Drops quotes and backslashes like sh: nothing is special inside '...', and inside "..."
+// only $references and a backslash before $ ` " \ or a newline are. Two passes, measure
+// then copy, so the arena gets exact allocations.
+static CmdError expandWord(CommandLine *line, const char *word, WordOut *out) {
+    out->value   = NULL;
+    out->pattern = NULL;
+
+    for (int pass = 0; pass < 2; pass++) {
+        int state = QUOTE_NONE;
+
+        out->value_len   = 0;
+        out->pattern_len = 0;
+        out->flags       = 0;
+        for (const char *p = word; *p != '\0'; ) {
+            char c = *p;
+
+            if (c == '$' && state != QUOTE_SINGLE) {
+                const char *value = NULL;
+                size_t      used  = 0;
+                CmdError    err   = VarsRef(p, &used, &value);
+                if (err != OK) {
+                    return err;
+                }
+                if (used > 0) {
+                    out->flags |= WORD_VARS;
+                    for (; *value != '\0'; value++) {
+                        putChar(out, *value, state == QUOTE_DOUBLE);
+                    }
+                    p += used;
+                    continue;
+                }
+            }
 
-            if (out->cmd_count >= MAX_COMMANDS) {
-                free(input_copy);
-                return TOO_MANY_COMMANDS;
+            if (state == QUOTE_SINGLE) {
+                if (c == '\'') {
+                    state = QUOTE_NONE;
+                }
+                else {
+                    putChar(out, c, 1);
+                }
+                p++;
+                continue;
             }
 
-            if (InitCommand(&out->cmds[out->cmd_count]) != OK) {
-                free(input_copy);
-                return ALLOC_ERR;
+            if (c == '\\' && p[1] != '\0' &&
+                (state == QUOTE_NONE || strchr("$`\"\\\n", p[1]) != NULL)) {
+                out->flags |= WORD_QUOTED;
+                putChar(out, p[1], 1);
+                p += 2;
+                continue;
+            }
+            if (c == '"' || (c == '\'' && state == QUOTE_NONE)) {
+                out->flags |= WORD_QUOTED;
+                state = state != QUOTE_NONE ? QUOTE_NONE : c == '"' ? QUOTE_DOUBLE : QUOTE_SINGLE;
+                p++;
+                continue;
             }
 
-            continue; 
+            putChar(out, c, state == QUOTE_DOUBLE);
+            p++;
         }
 
-        if (pipe_pos != NULL) {
-            char *before = fixBeforeTok(tok, pipe_pos);
-            if (before != NULL) {
-                if (AddArgument(cur, before) != OK) {
-                    free(input_copy);
-                    return TOO_MANY_ARGS;
+        if (pass == 0) {
+            out->value = (char*)ArenaAlloc(&line->arena, out->value_len + 1, 1);
+            if (out->value == NULL) {
+                return ALLOC_ERR;
+            }
+            if (out->flags & WORD_GLOB) {
+                out->pattern = (char*)ArenaAlloc(&line->arena, out->pattern_len + 1, 1);
+                if (out->pattern == NULL) {
+                    return ALLOC_ERR;
                 }
             }
+        }
+    }
 
-            out->cmd_count++;
-            if (out->cmd_count >= MAX_COMMANDS) {
-                free(input_copy);
-                return TOO_MANY_COMMANDS;
+    out->value[out->value_len] = '\0';
+    if (out->pattern != NULL) {
+        out->pattern[out->pattern_len] = '\0';
+    }
+    return OK;
+}
+
+// A word either completes a redirection that is still missing its file, or is an argument
+static CmdError emitWord(CommandLine *line, char *word, size_t *pending) {
+    WordOut out = {word, NULL, 0, 0, GlobHasMeta(word) ? WORD_GLOB : 0};
+
+    // Only words with quotes, backslashes or '$' are rewritten, the rest stay in place
+    if (strpbrk(word, "'\"\\$") != NULL) {
+        CmdError err = expandWord(line, word, &out);
+        if (err != OK) {
+            return err;
+        }
+        if (out.flags & WORD_VARS) {
+            line->dynamic = 1;
+        }
+        if (out.value_len == 0 && !(out.flags & WORD_QUOTED) && *pending == NO_PENDING) {
+            return OK;   // an unset variable leaves no empty argument behind, "" does
+        }
+    }
+
+    if (*pending != NO_PENDING) {
+        Redirect *r = &line->redirs[*pending];
+        r->target = out.value;
+        if (r->kind == REDIR_HEREDOC) {
+            r->expand = !(out.flags & WORD_QUOTED);
+            line->heredocs++;
+            line->dynamic = 1;   // the body is in the lines after this one
+        }
+        *pending = NO_PENDING;
+        return OK;
+    }
+
+    // 'NAME=value' before the command name is an assignment, not an argument
+    Command *cmd = &line->cmds[line->cmd_count];
+    if (cmd->argc == 0 && VarIsAssignment(word)) {
+        CmdError err = pushSlot(line, out.value);
+        if (err == OK) {
+            cmd->assign_count++;
+        }
+        return err;
+    }
+
+    if (out.flags & WORD_GLOB) {
+        return addGlob(line, out.pattern != NULL ? out.pattern : word, out.value);
+    }
+    return AddArgument(line, out.value);
+}
+
+static CmdError emitMatch(void *ctx, char *path) {
+    return AddArgument((CommandLine*)ctx, path);
+}
+
+static int compareWords(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Matches replace the word, sorted like sh does; with no match the word stays as it is
+static CmdError addGlob(CommandLine *line, const char *pattern, char *literal) {
+    size_t first = line->slot_count;
+    size_t count = 0;
+
+    line->dynamic = 1;
+    CmdError err = GlobExpand(&line->arena, &line->globs, pattern, emitMatch, line, &count);
+    if (err != OK) {
+        return err;
+    }
+    if (count == 0) {
+        return AddArgument(line, literal);
+    }
+
+    qsort(line->slots + first, count, sizeof(char*), compareWords);
+    return OK;
+}
+
+// First '<' or '>' of p that is not quoted or escaped
+static char* findOperator(char *p) {
+    char quote = 0;
+
+    for (; *p != '\0'; p++) {
+        if (quote != 0) {
+            if (*p == quote) {
+                quote = 0;
+            }
+            else if (quote == '"' && *p == '\\' && p[1] != '\0') {
+                p++;
             }
+            continue;
+        }
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        }
+        else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        }
+        else if (*p == '<' || *p == '>') {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Splits a token that contains '<' or '>' into words and redirections: [N]<file, [N]>file,
+// [N]>>file, [N]>&M, [N]<<WORD and [N]<<<word. The file or word may also be the next token.
+static CmdError addWord(CommandLine *line, char *tok, int has_redir, size_t *pending) {
+    if (!has_redir) {
+        return emitWord(line, tok, pending);
+    }
+
+    char    *p  = tok;
+    CmdError err = OK;
+    while (*p != '\0') {
+        char *op = findOperator(p);
+        if (op == NULL) {
+            return emitWord(line, p, pending);  // the tail is already NUL-terminated in place
+        }
 
-            cur = &out->cmds[out->cmd_count];
-            if (InitCommand(cur) != OK) {
-                free(input_copy);
+        Redirect redir = {REDIR_OUT, -1, NULL, -1, 0};
+        if (op - p == 1 && isdigit((unsigned char)*p)) {
+            redir.fd = *p - '0';
+        }
+        else if (op > p) {
+            char *word = ArenaStrndup(&line->arena, p, (size_t)(op - p));
+            if (word == NULL) {
                 return ALLOC_ERR;
             }
+            if ((err = emitWord(line, word, pending)) != OK) {
+                return err;
+            }
+        }
 
-            char *after = fixAfterTok(pipe_pos);
-            if (after != NULL) {
-                if (AddArgument(cur, after) != OK) {
-                    free(input_copy);
-                    return TOO_MANY_ARGS;
-                }
+        if (*pending != NO_PENDING) {
+            return SYNTAX_ERR;  // two operators in a row
+        }
+
+        char *q = op + 1;
+        if (*op == '<') {
+            redir.kind = REDIR_IN;
+            if (*q == '<') {
+                redir.kind = q[1] == '<' ? REDIR_HERESTRING : REDIR_HEREDOC;
+                q += redir.kind == REDIR_HERESTRING ? 2 : 1;
+            }
+        }
+        else if (*q == '>') {
+            redir.kind = REDIR_APPEND;
+            q++;
+        }
+        else if (*q == '&') {
+            redir.kind = REDIR_DUP;
+            q++;
+            if (!isdigit((unsigned char)*q)) {
+                return SYNTAX_ERR;
+            }
+            redir.target_fd = 0;
+            while (isdigit((unsigned char)*q)) {
+                redir.target_fd = redir.target_fd * 10 + (*q++ - '0');
             }
+        }
+        if (redir.fd == -1) {
+            redir.fd = *op == '<' ? STDIN_FILENO : STDOUT_FILENO;
+        }
 
-            continue;
+        if ((err = pushRedir(line, &redir)) != OK) {
+            return err;
+        }
+        if (redir.kind != REDIR_DUP) {
+            *pending = line->redir_total - 1;
         }
+        p = q;
+    }
+    return OK;
+}
 
-        if (AddArgument(cur, strdup(tok)) != OK) {
-            free(input_copy);
-            return TOO_MANY_ARGS;
+static CmdError AddArgument(CommandLine *line, char *arg) {
+    CmdError err = pushSlot(line, arg);
+    if (err != OK) {
+        return err;
+    }
+    line->cmds[line->cmd_count].argc++;
+    return OK;
+}
+
+// Called on '|' and at the end of input: the finished stage must not be empty, and a redirection
+// must have its file. A stage of only redirections or assignments (e.g. '> file') runs ':'.
+static CmdError closeCommand(CommandLine *line, size_t pending) {
+    Command *cmd = &line->cmds[line->cmd_count];
+    CmdError err = OK;
+
+    if (pending != NO_PENDING) {
+        return SYNTAX_ERR;
+    }
+    if (cmd->argc == 0) {
+        if (cmd->redir_count == 0 && cmd->assign_count == 0) {
+            return SYNTAX_ERR;
+        }
+        if ((err = AddArgument(line, NOOP_WORD)) != OK) {
+            return err;
         }
     }
 
-    if (out->cmds[out->cmd_count].argc > 0) {
-        out->cmd_count++;
+    err = pushSlot(line, NULL);
+    if (err != OK) {
+        return err;
     }
 
-    free(input_copy);
+    line->cmd_count++;
     return OK;
 }
 
-static char* fixBeforeTok(char *tok, char *pipe_pos) {
-    assert(tok);
-    assert(pipe_pos);
+// Bytes of a block that are quoted or escaped, so never separators or operators. quotes is
+// the scanner's mask of '\'', '"' and '\\'; only blocks with one of those, or that start inside
+// quotes, are walked at all. *state carries an open quote or a backslash to the next block.
+static uint64_t quotedBytes(const char *block, uint64_t quotes, int *state) {
+    uint64_t quoted = 0;
+    unsigned i      = 0;
+
+    while (i < SCAN_BLOCK) {
+        if (*state == QUOTE_NONE) {
+            uint64_t ahead = quotes >> i;
+            if (ahead == 0) {
+                break;
+            }
+            i += (unsigned)__builtin_ctzll(ahead);
+            char c = block[i++];
+            *state = c == '\\' ? QUOTE_ESCAPE : c == '\'' ? QUOTE_SINGLE : QUOTE_DOUBLE;
+            continue;
+        }
 
-    size_t len_str = (size_t)(pipe_pos - tok);
-    if (len_str == 0) {
-        return NULL;
+        char c = block[i];
+        quoted |= 1ULL << i++;
+        switch (*state) {
+            case QUOTE_ESCAPE:        *state = QUOTE_NONE;   break;
+            case QUOTE_DOUBLE_ESCAPE: *state = QUOTE_DOUBLE; break;
+            case QUOTE_SINGLE:
+                if (c == '\'') {
+                    *state = QUOTE_NONE;
+                }
+                break;
+            default:
+                if (c == '"') {
+                    *state = QUOTE_NONE;
+                }
+                else if (c == '\\') {
+                    *state = QUOTE_DOUBLE_ESCAPE;
+                }
+                break;
+        }
     }
+    return quoted;
+}
 
-    char *dup = (char*)calloc(len_str + 1, sizeof(char));
-    if (dup == NULL) {
-        return NULL;
+// Offset of the '#' that starts a comment, or len if there is none. Only a '#' at the start of
+// an unquoted word counts, so lines without one skip the extra scan altogether.
+static size_t findComment(const char *buf, size_t len) {
+    if (memchr(buf, '#', len) == NULL) {
+        return len;
     }
 
-    return strncpy(dup, tok, len_str);
+    uint64_t carry = 1;
+    int      quote = QUOTE_NONE;
+    for (size_t base = 0; base < len; base += SCAN_BLOCK) {
+        ScanMasks masks;
+        ScanBlock(buf + base, &masks);
+
+        size_t   left  = len - base;
+        uint64_t valid = left >= SCAN_BLOCK ? ~0ULL : (1ULL << left) - 1;
+        if ((masks.quote & valid) != 0 || quote != QUOTE_NONE) {
+            valid &= ~quotedBytes(buf + base, masks.quote & valid, &quote);
+        }
+        uint64_t sep    = (masks.space | masks.pipe) & valid;
+        uint64_t starts = ~sep & ((sep << 1) | carry) & valid;
+        carry = (sep >> (SCAN_BLOCK - 1)) & 1;
+
+        for (; starts != 0; starts &= starts - 1) {
+            unsigned i = (unsigned)__builtin_ctzll(starts);
+            if (buf[base + i] == '#') {
+                return base + i;
+            }
+        }
+    }
+    return len;
 }
 
-static char* fixAfterTok(char *pipe_pos) {
-    assert(pipe_pos);
+// Tokens and stage breaks are taken from the scanner bitmasks, 64 input bytes at a time:
+// a token starts on a non-separator preceded by a separator and ends on the separator after it.
+// Quoted bytes are masked out first, and tokens keep their quotes until emitWord().
+CmdError ParseCommandLine(const char *input, CommandLine *out) {
+    assert(input);
+    assert(out);
+
+    ResetCommandLine(out);
 
-    if (strlen(pipe_pos) == 1) {
-        return NULL;
+    // The only copy of the input: tokens are cut out of it in place. The zero padding
+    // lets the scanner always read whole blocks.
+    size_t len = strlen(input);
+    char  *buf = (char*)ArenaAlloc(&out->arena, len + SCAN_PADDING, SCAN_BLOCK);
+    if (buf == NULL) {
+        return ALLOC_ERR;
+    }
+    memcpy(buf, input, len);
+    memset(buf + len, 0, SCAN_PADDING);
+
+    // A word starting with '#' comments out the rest of the line, '&' in it included
+    size_t comment = findComment(buf, len);
+    memset(buf + comment, 0, len - comment);
+    len = comment;
+
+    // A trailing '&' puts the whole pipeline in the background, unless it is escaped
+    size_t last = len;
+    while (last > 0 && strchr(" \t\n", buf[last - 1]) != NULL) {
+        last--;
+    }
+    size_t backslashes = 0;
+    while (last > backslashes + 1 && buf[last - 2 - backslashes] == '\\') {
+        backslashes++;
+    }
+    if (last > 0 && buf[last - 1] == '&' && backslashes % 2 == 0) {
+        buf[last - 1]   = ' ';
+        out->background = 1;
+    }
+
+    CmdError err = openCommand(out);
+    if (err != OK) {
+        return err;
+    }
+
+    char     *tok       = NULL;
+    int       tok_redir = 0;          // tok contains '<' or '>'
+    size_t    pending   = NO_PENDING; // redirection still waiting for its file name
+    uint64_t  carry     = 1;          // the byte before the input counts as a separator
+    size_t    last_pipe = SIZE_MAX;   // offset of the latest '|', to spot '|>'
+    int       quote     = QUOTE_NONE; // open quote carried from one block to the next
+
+    for (size_t base = 0; base < len; base += SCAN_BLOCK) {
+        ScanMasks masks;
+        ScanBlock(buf + base, &masks);
+
+        size_t   left   = len - base;
+        uint64_t valid  = left >= SCAN_BLOCK ? ~0ULL : (1ULL << left) - 1;
+        uint64_t quoted = 0;
+        if ((masks.quote & valid) != 0 || quote != QUOTE_NONE) {
+            quoted = quotedBytes(buf + base, masks.quote & valid, &quote);
+            valid &= ~quoted;
+        }
+        uint64_t sep    = (masks.space | masks.pipe) & valid;
+        uint64_t prev   = (sep << 1) | carry;
+
+        uint64_t starts = ~sep & prev & valid;
+        uint64_t ends   = sep & ~prev;
+        uint64_t pipes  = masks.pipe & valid;
+        uint64_t redirs = masks.redir & valid;
+        carry = (sep >> (SCAN_BLOCK - 1)) & 1;
+
+        for (uint64_t events = starts | ends | pipes | redirs; events != 0; events &= events - 1) {
+            unsigned i   = (unsigned)__builtin_ctzll(events);
+            uint64_t bit = 1ULL << i;
+
+            if (ends & bit) {
+                buf[base + i] = '\0';
+                if (*tok != '\0' && (err = addWord(out, tok, tok_redir, &pending)) != OK) {
+                    return err;
+                }
+                tok = NULL;
+            }
+            if (pipes & bit) {
+                if ((err = closeCommand(out, pending)) != OK || (err = openCommand(out)) != OK) {
+                    return err;
+                }
+                last_pipe = base + i;
+            }
+            if (starts & bit) {
+                tok       = buf + base + i;
+                tok_redir = 0;
+                // '|>' right after the pipe: the '>' is an operator, not part of the word
+                if (last_pipe != SIZE_MAX && base + i == last_pipe + 1 && *tok == '>') {
+                    out->cmds[out->cmd_count - 1].buffer_out = 1;
+                    tok++;
+                }
+            }
+            if (redirs & bit) {
+                tok_redir = 1;
+            }
+        }
+    }
+
+    if (quote == QUOTE_SINGLE || quote == QUOTE_DOUBLE || quote == QUOTE_DOUBLE_ESCAPE) {
+        return SYNTAX_ERR;  // unterminated quote
     }
-    else {
-        char *start = pipe_pos + 1;
 
-        while (isspace(*start)) {
-            start++;
+    if (tok != NULL && *tok != '\0') {
+        if ((err = addWord(out, tok, tok_redir, &pending)) != OK) {
+            return err;
         }
+    }
 
-        size_t len_str = strlen(start);
-        char *dup = (char*)calloc(len_str + 1, sizeof(char));
-        if (dup == NULL) {
-            return NULL;
+    Command *last_cmd = &out->cmds[out->cmd_count];
+    if (last_cmd->argc > 0 || last_cmd->redir_count > 0 || last_cmd->assign_count > 0 ||
+        pending != NO_PENDING) {
+        if ((err = closeCommand(out, pending)) != OK) {
+            return err;
         }
+    }
+    else if (out->cmd_count > 0 || out->background) {
+        return SYNTAX_ERR;  // trailing '|', or '&' with nothing to run
+    }
+
+    char     **argv  = out->slots;
+    Redirect *redirs = out->redirs;
+    for (size_t i = 0; i < out->cmd_count; i++) {
+        out->cmds[i].assigns = out->cmds[i].assign_count > 0 ? argv : NULL;
+        argv += out->cmds[i].assign_count;
 
-        return strncpy(dup, start, len_str);
+        out->cmds[i].argv   = argv;
+        out->cmds[i].redirs = out->cmds[i].redir_count > 0 ? redirs : NULL;
+        argv   += out->cmds[i].argc + 1;
+        redirs += out->cmds[i].redir_count;
     }
+
+    // 'time PIPELINE' is a keyword for the whole pipeline, not a command
+    if (out->cmd_count > 0 && out->cmds[0].argc > 1 && strcmp(out->cmds[0].argv[0], "time") == 0) {
+        out->cmds[0].argv++;
+        out->cmds[0].argc--;
+        out->timed = 1;
+    }
+
+    return OK;
 }
 
 void PrintCommandLineTable(CommandLine *cline) {
@@ -192,10 +691,27 @@ void PrintCommandLineTable(CommandLine *cline) {
     for (size_t i = 0; i < cline->cmd_count; i++) 
     {
         printf("Command %zu (argc=%zu): ", i, cline->cmds[i].argc);
+        for (size_t j = 0; j < cline->cmds[i].assign_count; j++) 
+        {
+            printf("<%s> ", cline->cmds[i].assigns[j]);
+        }
         for (size_t j = 0; j < cline->cmds[i].argc; j++) 
         {
             printf("[%s] ", cline->cmds[i].argv[j]);
         }
+        for (size_t j = 0; j < cline->cmds[i].redir_count; j++) 
+        {
+            Redirect *r = &cline->cmds[i].redirs[j];
+            if (r->kind == REDIR_DUP)
+            {
+                printf("{%d>&%d} ", r->fd, r->target_fd);
+            }
+            else
+            {
+                static const char *ops[] = {"<", ">", ">>", ">&", "<<", "<<<"};
+                printf("{%d%s%s} ", r->fd, ops[r->kind], r->target);
+            }
+        }
         printf("\n"); 
     }
 }
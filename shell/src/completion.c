@@ -0,0 +1,430 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "completion.h"
+#include "variables.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+                      IN_DELETE_SELF | IN_MOVE_SELF)
+#define EVENT_BUF    (64 * 1024)
+#define LIST_COLUMNS 80
+
+// Edges carry whole strings; a node only exists where names branch or end
+typedef struct TrieNode TrieNode;
+struct TrieNode {
+    char     *label;
+    size_t   label_len;
+    TrieNode **kids;      // sorted by first byte of the label
+    size_t   nkids;
+    size_t   kid_cap;
+    size_t   dirs;        // PATH directories with an executable of exactly this name
+    size_t   live;        // names with dirs > 0 in this subtree, this node included
+};
+
+typedef struct {
+    TrieNode root;
+    char     *path_env;   // $PATH the trie was built for
+    char     **dirs;
+    int      *wds;        // inotify watch per directory, -1 if it could not be watched
+    size_t   ndirs;
+    int      inotify_fd;
+} Completion;
+
+static Completion comp = {{NULL, 0, NULL, 0, 0, 0, 0}, NULL, NULL, NULL, 0, -1};
+
+static TrieNode* newNode   (const char *label, size_t len);
+static void      freeNode  (TrieNode *node);
+static CmdError  addKid    (TrieNode *parent, TrieNode *kid);
+static TrieNode* findKid   (TrieNode *parent, char c);
+static CmdError  setName   (const char *name, size_t dirs);
+static TrieNode* walkPrefix(const char *prefix, size_t len, size_t *edge_used, size_t *depth);
+static void      listNames (TrieNode *node, char *name, size_t len, FILE *out, size_t *col);
+static size_t    countDirs (const char *name);
+static int       isCommand (int dirfd, const char *name);
+static CmdError  build     ();
+static void      teardown  ();
+static void      drainEvents();
+
+static TrieNode* newNode(const char *label, size_t len) {
+    TrieNode *node = (TrieNode*)calloc(1, sizeof(TrieNode));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->label = strndup(label, len);
+    if (node->label == NULL) {
+        free(node);
+        return NULL;
+    }
+    node->label_len = len;
+    return node;
+}
+
+static void freeNode(TrieNode *node) {
+    for (size_t i = 0; i < node->nkids; i++) {
+        freeNode(node->kids[i]);
+        free(node->kids[i]);
+    }
+    free(node->kids);
+    free(node->label);
+    memset(node, 0, sizeof(*node));
+}
+
+static CmdError addKid(TrieNode *parent, TrieNode *kid) {
+    if (parent->nkids == parent->kid_cap) {
+        size_t    new_cap = parent->kid_cap == 0 ? 4 : parent->kid_cap * 2;
+        TrieNode **kids   = (TrieNode**)realloc(parent->kids, new_cap * sizeof(TrieNode*));
+        if (kids == NULL) {
+            return ALLOC_ERR;
+        }
+        parent->kids    = kids;
+        parent->kid_cap = new_cap;
+    }
+
+    size_t i = parent->nkids;
+    while (i > 0 && (unsigned char)parent->kids[i - 1]->label[0] > (unsigned char)kid->label[0]) {
+        parent->kids[i] = parent->kids[i - 1];
+        i--;
+    }
+    parent->kids[i] = kid;
+    parent->nkids++;
+    return OK;
+}
+
+static TrieNode* findKid(TrieNode *parent, char c) {
+    size_t lo = 0;
+    size_t hi = parent->nkids;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        unsigned char k = (unsigned char)parent->kids[mid]->label[0];
+        if (k == (unsigned char)c) {
+            return parent->kids[mid];
+        }
+        if (k < (unsigned char)c) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Inserts the name if needed and records in how many PATH directories it lives.
+// Nodes of names that disappear stay in place with live == 0 and are skipped.
+static CmdError setName(const char *name, size_t dirs) {
+    TrieNode *path[NAME_MAX + 2];
+    size_t    depth = 0;
+    TrieNode *node  = &comp.root;
+    size_t    len   = strlen(name);
+    size_t    pos   = 0;
+
+    path[depth++] = node;
+    while (pos < len) {
+        TrieNode *kid = findKid(node, name[pos]);
+        if (kid == NULL) {
+            if (dirs == 0) {
+                return OK;   // removing a name we never had
+            }
+            kid = newNode(name + pos, len - pos);
+            if (kid == NULL || addKid(node, kid) != OK) {
+                free(kid);
+                return ALLOC_ERR;
+            }
+            node = kid;
+            pos  = len;
+            path[depth++] = node;
+            break;
+        }
+
+        size_t common = 0;
+        while (common < kid->label_len && pos + common < len && kid->label[common] == name[pos + common]) {
+            common++;
+        }
+
+        if (common < kid->label_len) {
+            if (dirs == 0) {
+                return OK;
+            }
+            // Split the edge: kid keeps the tail of its label under a new middle node
+            TrieNode *mid = newNode(kid->label, common);
+            if (mid == NULL) {
+                return ALLOC_ERR;
+            }
+            memmove(kid->label, kid->label + common, kid->label_len - common + 1);
+            kid->label_len -= common;
+            mid->live = kid->live;
+
+            for (size_t i = 0; i < node->nkids; i++) {
+                if (node->kids[i] == kid) {
+                    node->kids[i] = mid;
+                }
+            }
+            if (addKid(mid, kid) != OK) {
+                return ALLOC_ERR;
+            }
+            kid = mid;
+        }
+
+        node = kid;
+        pos += common;
+        path[depth++] = node;
+    }
+
+    long delta = (long)(dirs > 0) - (long)(node->dirs > 0);
+    node->dirs = dirs;
+    for (size_t i = 0; i < depth && delta != 0; i++) {
+        path[i]->live = (size_t)((long)path[i]->live + delta);
+    }
+    return OK;
+}
+
+// Node whose edge the prefix ends on; *edge_used says how much of that edge it covers
+static TrieNode* walkPrefix(const char *prefix, size_t len, size_t *edge_used, size_t *depth) {
+    TrieNode *node = &comp.root;
+    size_t    pos  = 0;
+
+    *edge_used = 0;
+    while (pos < len) {
+        TrieNode *kid = findKid(node, prefix[pos]);
+        if (kid == NULL || kid->live == 0) {
+            return NULL;
+        }
+        size_t n = 0;
+        while (n < kid->label_len && pos + n < len && kid->label[n] == prefix[pos + n]) {
+            n++;
+        }
+        if (pos + n < len && n < kid->label_len) {
+            return NULL;   // diverges inside the edge
+        }
+        node       = kid;
+        pos       += n;
+        *edge_used = n;
+    }
+    *depth = pos;
+    return node;
+}
+
+static int isCommand(int dirfd, const char *name) {
+    struct stat st;
+    return fstatat(dirfd, name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+           faccessat(dirfd, name, X_OK, AT_EACCESS) == 0;
+}
+
+static size_t countDirs(const char *name) {
+    size_t count = 0;
+    for (size_t i = 0; i < comp.ndirs; i++) {
+        int fd = open(comp.dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd != -1) {
+            count += (size_t)isCommand(fd, name);
+            close(fd);
+        }
+    }
+    return count;
+}
+
+static CmdError build() {
+    const char *path_env = VarGet("PATH");
+    comp.path_env = strdup(path_env != NULL ? path_env : "");
+    if (comp.path_env == NULL) {
+        return ALLOC_ERR;
+    }
+
+    comp.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    size_t ndirs = 1;
+    for (const char *p = comp.path_env; *p != '\0'; p++) {
+        ndirs += *p == ':';
+    }
+    comp.dirs = (char**)calloc(ndirs, sizeof(char*));
+    comp.wds  = (int*)calloc(ndirs, sizeof(int));
+    if (comp.dirs == NULL || comp.wds == NULL) {
+        return ALLOC_ERR;
+    }
+
+    char *save = NULL;
+    char *list = strdup(comp.path_env);
+    if (list == NULL) {
+        return ALLOC_ERR;
+    }
+    for (char *dir = strtok_r(list, ":", &save); dir != NULL; dir = strtok_r(NULL, ":", &save)) {
+        size_t i = comp.ndirs++;
+        comp.dirs[i] = strdup(dir);
+        comp.wds[i]  = comp.inotify_fd == -1 || comp.dirs[i] == NULL ? -1
+                     : inotify_add_watch(comp.inotify_fd, dir, WATCH_EVENTS);
+
+        DIR *d = comp.dirs[i] != NULL ? opendir(dir) : NULL;
+        if (d == NULL) {
+            continue;
+        }
+        struct dirent *e = NULL;
+        while ((e = readdir(d)) != NULL) {
+            if (e->d_name[0] == '.' || e->d_type == DT_DIR || !isCommand(dirfd(d), e->d_name)) {
+                continue;
+            }
+            size_t     edge  = 0;
+            size_t     depth = 0;
+            size_t     len   = strlen(e->d_name);
+            TrieNode  *node  = walkPrefix(e->d_name, len, &edge, &depth);
+            size_t     dirs  = node != NULL && depth == len && edge == node->label_len ? node->dirs : 0;
+            if (setName(e->d_name, dirs + 1) != OK) {
+                closedir(d);
+                free(list);
+                return ALLOC_ERR;
+            }
+        }
+        closedir(d);
+    }
+    free(list);
+    return OK;
+}
+
+static void teardown() {
+    freeNode(&comp.root);
+    for (size_t i = 0; i < comp.ndirs; i++) {
+        free(comp.dirs[i]);
+    }
+    free(comp.dirs);
+    free(comp.wds);
+    free(comp.path_env);
+    if (comp.inotify_fd != -1) {
+        close(comp.inotify_fd);
+    }
+    memset(&comp, 0, sizeof(comp));
+    comp.inotify_fd = -1;
+}
+
+CmdError CompletionInit() {
+    CmdError err = build();
+    if (err != OK) {
+        teardown();
+    }
+    return err;
+}
+
+void CompletionFree() {
+    teardown();
+}
+
+// Each event names one file: recount just that name over the PATH directories
+static void drainEvents() {
+    const char *path_env = VarGet("PATH");
+    if (strcmp(path_env != NULL ? path_env : "", comp.path_env != NULL ? comp.path_env : "") != 0) {
+        teardown();
+        build();   // a different PATH is a different set of names
+        return;
+    }
+    if (comp.inotify_fd == -1) {
+        return;
+    }
+
+    char buf[EVENT_BUF] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n = 0;
+    while ((n = read(comp.inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_Q_OVERFLOW)) {
+                teardown();
+                build();
+                return;
+            }
+            if (ev->len > 0 && ev->name[0] != '.') {
+                setName(ev->name, countDirs(ev->name));
+            }
+        }
+    }
+}
+
+// Writes to out what every command name starting with prefix has in common after it,
+// and sets *matches to how many such names there are.
+size_t CompletionExtend(const char *prefix, size_t len, char *out, size_t out_cap, size_t *matches) {
+    assert(prefix);
+    assert(out);
+    assert(matches);
+
+    drainEvents();
+
+    size_t    edge  = 0;
+    size_t    depth = 0;
+    TrieNode *node  = walkPrefix(prefix, len, &edge, &depth);
+
+    *matches = node != NULL ? node->live : 0;
+    if (node == NULL || out_cap == 0) {
+        return 0;
+    }
+
+    size_t n = 0;
+    for (size_t i = edge; i < node->label_len && n + 1 < out_cap; i++) {
+        out[n++] = node->label[i];
+    }
+
+    // Keep going while there is only one way on and no name ends here
+    while (node->dirs == 0) {
+        TrieNode *only = NULL;
+        size_t    ways = 0;
+        for (size_t i = 0; i < node->nkids; i++) {
+            if (node->kids[i]->live > 0) {
+                only = node->kids[i];
+                ways++;
+            }
+        }
+        if (ways != 1 || n + only->label_len + 1 > out_cap) {
+            break;
+        }
+        memcpy(out + n, only->label, only->label_len);
+        n   += only->label_len;
+        node = only;
+    }
+
+    out[n] = '\0';
+    return n;
+}
+
+static void listNames(TrieNode *node, char *name, size_t len, FILE *out, size_t *col) {
+    if (node->live == 0 || len + node->label_len >= NAME_MAX + 1) {
+        return;
+    }
+    memcpy(name + len, node->label, node->label_len);
+    len += node->label_len;
+
+    if (node->dirs > 0) {
+        if (*col + len + 2 > LIST_COLUMNS) {
+            fputc('\n', out);
+            *col = 0;
+        }
+        fprintf(out, "%.*s  ", (int)len, name);
+        *col += len + 2;
+    }
+    for (size_t i = 0; i < node->nkids; i++) {
+        listNames(node->kids[i], name, len, out, col);
+    }
+}
+
+void CompletionList(const char *prefix, size_t len, FILE *out) {
+    assert(prefix);
+    assert(out);
+
+    drainEvents();
+
+    size_t    edge  = 0;
+    size_t    depth = 0;
+    TrieNode *node  = walkPrefix(prefix, len, &edge, &depth);
+    if (node == NULL) {
+        return;
+    }
+
+    char   name[NAME_MAX + 1];
+    size_t col = 0;
+    size_t at  = depth - edge;   // where the node's label starts
+    memcpy(name, prefix, at);
+    listNames(node, name, at, out, &col);
+    fputc('\n', out);
+}
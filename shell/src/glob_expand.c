@@ -0,0 +1,475 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "glob_expand.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define DIRENT_BUF       (64 * 1024)
+#define INITIAL_DIRS     16
+#define INITIAL_ENTRIES  64
+#define GLOBSTAR         "**"
+
+// Layout the kernel fills in for getdents64()
+typedef struct {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+} LinuxDirent64;
+
+typedef struct {
+    char          *name;
+    unsigned char type;   // DT_*, DT_UNKNOWN if the filesystem does not say
+} DirEntry;
+
+typedef struct {
+    char     *path;
+    uint64_t hash;
+    DirEntry *entries;
+    size_t   count;       // 0 also for a directory that cannot be read
+} DirListing;
+
+struct GlobCache {
+    DirListing **table;   // open addressing, power-of-two capacity
+    size_t     cap;
+    size_t     count;
+};
+
+typedef struct {
+    Arena     *arena;
+    GlobCache *cache;
+    char      **comps;    // pattern split on '/'
+    size_t    ncomps;
+    int       want_dir;   // pattern ended with '/'
+    GlobEmit  emit;
+    void      *ctx;
+    size_t    count;
+    char      path[PATH_MAX];
+} GlobWalk;
+
+static char dirent_buf[DIRENT_BUF] __attribute__((aligned(8)));
+
+static uint64_t    hashPath    (const char *path);
+static int         matchBracket(const char **pat, char c);
+static int         matchName   (const char *pat, const char *name);
+static DirListing* listDir     (GlobWalk *w, const char *path);
+static CmdError    readDir     (Arena *arena, int fd, DirListing *dir);
+static CmdError    cacheInsert (Arena *arena, GlobCache *cache, DirListing *dir);
+static int         isDir       (const char *path, unsigned char type, int follow);
+static size_t      joinPath    (GlobWalk *w, size_t len, const char *name);
+static size_t      unescape    (char *text);
+static CmdError    emitPath    (GlobWalk *w, size_t len, int listed);
+static CmdError    walk        (GlobWalk *w, size_t len, size_t comp, int listed);
+
+// A backslash makes the next character literal: that is how quoted ones reach us.
+// '[' only counts once a ']' closes it, as in bash, so 'test' spelled '[ -f a ]' is no glob.
+int GlobHasMeta(const char *word) {
+    int bracket = 0;
+    for (const char *p = strpbrk(word, "*?[]\\"); p != NULL; p = strpbrk(p + 1, "*?[]\\")) {
+        if (*p == '*' || *p == '?' || (*p == ']' && bracket)) {
+            return 1;
+        }
+        if (*p == '[') {
+            bracket = 1;
+        }
+        else if (*p == '\\' && *++p == '\0') {
+            break;
+        }
+    }
+    return 0;
+}
+
+static uint64_t hashPath(const char *path) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a
+    for (; *path != '\0'; path++) {
+        h ^= (unsigned char)*path;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// *pat is at '['. Returns whether c is in the set and moves *pat past ']',
+// or -1 if the bracket is never closed and has to be taken literally.
+static int matchBracket(const char **pat, char c) {
+    const char *p = *pat + 1;
+    int negate = *p == '!' || *p == '^';
+    p += negate;
+
+    int found = 0;
+    int first = 1;
+    while (*p != ']' || first) {
+        if (*p == '\0') {
+            return -1;
+        }
+        char lo = *p++;
+        char hi = lo;
+        if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+            hi = p[1];
+            p += 2;
+        }
+        found |= (unsigned char)c >= (unsigned char)lo && (unsigned char)c <= (unsigned char)hi;
+        first = 0;
+    }
+
+    *pat = p + 1;
+    return found != negate;
+}
+
+// Single backtrack point for the latest '*': linear in practice, never exponential
+static int matchName(const char *pat, const char *name) {
+    const char *star_pat  = NULL;
+    const char *star_name = NULL;
+
+    while (*name != '\0') {
+        if (*pat == '\\' && pat[1] != '\0') {
+            if (pat[1] != *name) {
+                goto backtrack;
+            }
+            pat  += 2;
+            name++;
+            continue;
+        }
+        if (*pat == '*') {
+            star_pat  = ++pat;
+            star_name = name;
+            continue;
+        }
+        if (*pat == '?') {
+            pat++;
+            name++;
+            continue;
+        }
+        if (*pat == '[') {
+            const char *p = pat;
+            int in_set = matchBracket(&p, *name);
+            if (in_set == 1) {
+                pat = p;
+                name++;
+                continue;
+            }
+            if (in_set == 0) {
+                goto backtrack;
+            }
+        }
+        if (*pat == *name) {
+            pat++;
+            name++;
+            continue;
+        }
+
+    backtrack:
+        if (star_pat == NULL) {
+            return 0;
+        }
+        pat  = star_pat;
+        name = ++star_name;
+    }
+
+    while (*pat == '*') {
+        pat++;
+    }
+    return *pat == '\0';
+}
+
+static CmdError cacheInsert(Arena *arena, GlobCache *cache, DirListing *dir) {
+    if (2 * (cache->count + 1) > cache->cap) {
+        size_t      new_cap = cache->cap == 0 ? INITIAL_DIRS : cache->cap * 2;
+        DirListing **table  = (DirListing**)ArenaAlloc(arena, new_cap * sizeof(DirListing*),
+                                                       _Alignof(DirListing*));
+        if (table == NULL) {
+            return ALLOC_ERR;
+        }
+        memset(table, 0, new_cap * sizeof(DirListing*));
+
+        for (size_t i = 0; i < cache->cap; i++) {
+            DirListing *old = cache->table[i];
+            if (old == NULL) {
+                continue;
+            }
+            size_t j = old->hash & (new_cap - 1);
+            while (table[j] != NULL) {
+                j = (j + 1) & (new_cap - 1);
+            }
+            table[j] = old;
+        }
+        cache->table = table;   // the old table stays in the arena until the line is done
+        cache->cap   = new_cap;
+    }
+
+    size_t j = dir->hash & (cache->cap - 1);
+    while (cache->table[j] != NULL) {
+        j = (j + 1) & (cache->cap - 1);
+    }
+    cache->table[j] = dir;
+    cache->count++;
+    return OK;
+}
+
+static CmdError readDir(Arena *arena, int fd, DirListing *dir) {
+    size_t cap = 0;
+
+    while (1) {
+        long n = syscall(SYS_getdents64, fd, dirent_buf, sizeof(dirent_buf));
+        if (n <= 0) {
+            return OK;   // an unreadable directory simply has no matches
+        }
+
+        for (long off = 0; off < n; ) {
+            LinuxDirent64 *d = (LinuxDirent64*)(dirent_buf + off);
+            off += d->d_reclen;
+
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            if (dir->count == cap) {
+                size_t    new_cap = cap == 0 ? INITIAL_ENTRIES : cap * 2;
+                DirEntry *entries = (DirEntry*)ArenaAlloc(arena, new_cap * sizeof(DirEntry),
+                                                          _Alignof(DirEntry));
+                if (entries == NULL) {
+                    return ALLOC_ERR;
+                }
+                if (dir->count > 0) {
+                    memcpy(entries, dir->entries, dir->count * sizeof(DirEntry));
+                }
+                dir->entries = entries;
+                cap          = new_cap;
+            }
+
+            DirEntry *e = &dir->entries[dir->count];
+            e->name = ArenaStrndup(arena, name, strlen(name));
+            e->type = d->d_type;
+            if (e->name == NULL) {
+                return ALLOC_ERR;
+            }
+            dir->count++;
+        }
+    }
+}
+
+// Each directory is read at most once per command line, however many patterns touch it
+static DirListing* listDir(GlobWalk *w, const char *path) {
+    GlobCache *cache = w->cache;
+    uint64_t   hash  = hashPath(path);
+
+    for (size_t j = hash & (cache->cap - 1); cache->cap > 0 && cache->table[j] != NULL;
+         j = (j + 1) & (cache->cap - 1)) {
+        if (cache->table[j]->hash == hash && strcmp(cache->table[j]->path, path) == 0) {
+            return cache->table[j];
+        }
+    }
+
+    DirListing *dir = (DirListing*)ArenaAlloc(w->arena, sizeof(DirListing), _Alignof(DirListing));
+    if (dir == NULL) {
+        return NULL;
+    }
+    dir->path    = ArenaStrndup(w->arena, path, strlen(path));
+    dir->hash    = hash;
+    dir->entries = NULL;
+    dir->count   = 0;
+    if (dir->path == NULL) {
+        return NULL;
+    }
+
+    int fd = open(path[0] != '\0' ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd != -1) {
+        CmdError err = readDir(w->arena, fd, dir);
+        close(fd);
+        if (err != OK) {
+            return NULL;
+        }
+    }
+
+    return cacheInsert(w->arena, cache, dir) == OK ? dir : NULL;
+}
+
+// d_type answers without a syscall; symlinks are only followed outside of '**'
+static int isDir(const char *path, unsigned char type, int follow) {
+    if (type == DT_DIR) {
+        return 1;
+    }
+    if (type != DT_UNKNOWN && !(type == DT_LNK && follow)) {
+        return 0;
+    }
+
+    struct stat st;
+    return fstatat(AT_FDCWD, path, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Appends one component to w->path; returns the new length, or 0 if it does not fit
+static size_t joinPath(GlobWalk *w, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+    size_t sep      = len > 0 && w->path[len - 1] != '/' ? 1 : 0;
+    if (len + sep + name_len + 1 >= sizeof(w->path)) {
+        return 0;
+    }
+
+    if (sep) {
+        w->path[len] = '/';
+    }
+    memcpy(w->path + len + sep, name, name_len + 1);
+    return len + sep + name_len;
+}
+
+// Drops the backslashes of a literal component in place; returns the new length
+static size_t unescape(char *text) {
+    char *out = text;
+    for (const char *p = text; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+        }
+        *out++ = *p;
+    }
+    *out = '\0';
+    return (size_t)(out - text);
+}
+
+// Paths built from literal components were never seen in a listing, so check they exist
+static CmdError emitPath(GlobWalk *w, size_t len, int listed) {
+    struct stat st;
+    if (!listed && fstatat(AT_FDCWD, w->path, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return OK;
+    }
+    if (w->want_dir) {
+        if (!isDir(w->path, DT_UNKNOWN, 1) || len + 1 >= sizeof(w->path)) {
+            return OK;
+        }
+        w->path[len]     = '/';
+        w->path[len + 1] = '\0';
+        len++;
+    }
+
+    char *copy = ArenaStrndup(w->arena, w->path, len);
+    if (copy == NULL) {
+        return ALLOC_ERR;
+    }
+    w->count++;
+    return w->emit(w->ctx, copy);
+}
+
+static CmdError walk(GlobWalk *w, size_t len, size_t comp, int listed) {
+    if (comp == w->ncomps) {
+        return emitPath(w, len, listed);
+    }
+
+    const char *pat = w->comps[comp];
+    if (!GlobHasMeta(pat)) {
+        size_t next = joinPath(w, len, pat);
+        if (next != 0 && strchr(pat, '\\') != NULL) {
+            next = len + unescape(w->path + len);
+        }
+        return next == 0 ? OK : walk(w, next, comp + 1, 0);
+    }
+
+    int globstar = strcmp(pat, GLOBSTAR) == 0;
+    int last     = comp + 1 == w->ncomps;
+    CmdError err = OK;
+
+    // '**' may also stand for no directory at all
+    if (globstar && !last && (err = walk(w, len, comp + 1, listed)) != OK) {
+        return err;
+    }
+
+    w->path[len] = '\0';
+    DirListing *dir = listDir(w, w->path);
+    if (dir == NULL) {
+        return ALLOC_ERR;
+    }
+
+    for (size_t i = 0; i < dir->count; i++) {
+        const DirEntry *e = &dir->entries[i];
+        if (e->name[0] == '.' && pat[0] != '.') {
+            continue;   // hidden files need an explicit leading '.'
+        }
+        if (!globstar && !matchName(pat, e->name)) {
+            continue;
+        }
+
+        size_t next = joinPath(w, len, e->name);
+        if (next == 0) {
+            continue;
+        }
+
+        if (globstar) {
+            if (last && (err = emitPath(w, next, 1)) != OK) {
+                return err;
+            }
+            if (isDir(w->path, e->type, 0) && (err = walk(w, next, comp, 1)) != OK) {
+                return err;
+            }
+            continue;
+        }
+
+        if (last) {
+            err = emitPath(w, next, 1);
+        }
+        else if (isDir(w->path, e->type, 1)) {
+            err = walk(w, next, comp + 1, 1);
+        }
+        if (err != OK) {
+            return err;
+        }
+    }
+    return OK;
+}
+
+// Calls emit once per match, in directory order; *count is 0 if nothing matched.
+CmdError GlobExpand(Arena *arena, GlobCache **cache, const char *pattern,
+                    GlobEmit emit, void *ctx, size_t *count) {
+    assert(arena);
+    assert(cache);
+    assert(pattern);
+    assert(emit);
+    assert(count);
+
+    *count = 0;
+    if (*cache == NULL) {
+        *cache = (GlobCache*)ArenaAlloc(arena, sizeof(GlobCache), _Alignof(GlobCache));
+        if (*cache == NULL) {
+            return ALLOC_ERR;
+        }
+        memset(*cache, 0, sizeof(GlobCache));
+    }
+
+    size_t pat_len = strlen(pattern);
+    char  *copy    = ArenaStrndup(arena, pattern, pat_len);
+    char **comps   = (char**)ArenaAlloc(arena, (pat_len / 2 + 1) * sizeof(char*), _Alignof(char*));
+    if (copy == NULL || comps == NULL) {
+        return ALLOC_ERR;
+    }
+
+    GlobWalk w = {
+        .arena    = arena,
+        .cache    = *cache,
+        .comps    = comps,
+        .ncomps   = 0,
+        .want_dir = pat_len > 0 && pattern[pat_len - 1] == '/',
+        .emit     = emit,
+        .ctx      = ctx,
+        .count    = 0,
+    };
+
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, "/", &save); tok != NULL; tok = strtok_r(NULL, "/", &save)) {
+        comps[w.ncomps++] = tok;
+    }
+
+    size_t len = 0;
+    if (pattern[0] == '/') {
+        w.path[len++] = '/';
+    }
+    w.path[len] = '\0';
+
+    CmdError err = walk(&w, len, 0, 0);
+    *count = w.count;
+    return err;
+}
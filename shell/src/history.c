@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "history.h"
+#include "variables.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define INITIAL_GRAMS   4096
+#define INITIAL_POSTING 4
+#define NO_MATCH        SIZE_MAX
+
+typedef struct {
+    uint32_t key;      // three bytes of text, 0 marks a free slot
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *offsets; // ascending start offsets of the entries containing the trigram
+} Posting;
+
+typedef struct {
+    int     fd;
+    char    *map;
+    size_t  map_size;
+    size_t  indexed;   // entries before this offset are in the index
+    int     indexing;  // the index has been built, keep it up to date
+    Posting *grams;
+    size_t  gram_cap;
+    size_t  gram_count;
+    char    *last;     // previous line added by this shell, to skip repeats
+    size_t  last_len;
+} History;
+
+static History hist = {-1, NULL, 0, 0, 0, NULL, 0, 0, NULL, 0};
+
+static CmdError syncMap    ();
+static CmdError syncIndex  ();
+static Posting* findGram   (uint32_t key, int create);
+static CmdError growGrams  ();
+static CmdError indexEntry (size_t start, size_t end);
+static size_t   entryEnd   (size_t start);
+static size_t   entryStart (size_t end);
+static size_t   scanBack   (const char *needle, size_t needle_len, size_t before);
+static void     printTail  (size_t count);
+static void     printMatches(const char *needle, int newest_first);
+
+CmdError HistoryOpen(int create) {
+    char        path[PATH_MAX];
+    const char *file = VarGet("HISTFILE");
+    if (file == NULL || *file == '\0') {
+        const char *home = VarGet("HOME");
+        if (home == NULL) {
+            return READ_ERR;
+        }
+        snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE);
+        file = path;
+    }
+
+    int flags = O_RDWR | O_APPEND | O_CLOEXEC | (create ? O_CREAT : 0);
+    hist.fd = open(file, flags, 0600);
+    if (hist.fd == -1) {
+        return READ_ERR;
+    }
+    return syncMap();
+}
+
+void HistoryClose() {
+    if (hist.map != NULL) {
+        munmap(hist.map, hist.map_size);
+    }
+    if (hist.fd != -1) {
+        close(hist.fd);
+    }
+    for (size_t i = 0; i < hist.gram_cap; i++) {
+        free(hist.grams[i].offsets);
+    }
+    free(hist.grams);
+    free(hist.last);
+    memset(&hist, 0, sizeof(hist));
+    hist.fd = -1;
+}
+
+// Other shells append too: follow the file size, the mapping only ever grows
+static CmdError syncMap() {
+    struct stat st;
+    if (fstat(hist.fd, &st) != 0) {
+        return READ_ERR;
+    }
+
+    size_t size = (size_t)st.st_size;
+    if (size <= hist.map_size) {
+        return OK;
+    }
+    if (size > UINT32_MAX) {
+        size = UINT32_MAX;   // postings hold 32-bit offsets
+    }
+
+    char *map = hist.map == NULL ? (char*)mmap(NULL, size, PROT_READ, MAP_SHARED, hist.fd, 0)
+                                 : (char*)mremap(hist.map, hist.map_size, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        return ALLOC_ERR;
+    }
+    hist.map      = map;
+    hist.map_size = size;
+    return OK;
+}
+
+// The line goes in with its newline in one writev() on an O_APPEND descriptor,
+// so entries from concurrent shells never interleave.
+void HistoryAdd(const char *line, size_t len) {
+    assert(line);
+
+    if (hist.fd == -1) {
+        return;
+    }
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == ' ' || line[len - 1] == '\t')) {
+        len--;
+    }
+    if (len == 0 || memchr(line, '\n', len) != NULL) {
+        return;
+    }
+    if (hist.last != NULL && hist.last_len == len && memcmp(hist.last, line, len) == 0) {
+        return;
+    }
+
+    struct iovec iov[2] = {
+        {(void*)(uintptr_t)line, len},
+        {"\n",                   1  },
+    };
+    if (writev(hist.fd, iov, 2) != (ssize_t)(len + 1)) {
+        return;
+    }
+
+    char *last = (char*)realloc(hist.last, len);
+    if (last != NULL) {
+        memcpy(last, line, len);
+        hist.last     = last;
+        hist.last_len = len;
+    }
+
+    if (hist.indexing) {
+        syncIndex();
+    }
+}
+
+static CmdError growGrams() {
+    size_t   new_cap = hist.gram_cap == 0 ? INITIAL_GRAMS : hist.gram_cap * 2;
+    Posting *grams   = (Posting*)calloc(new_cap, sizeof(Posting));
+    if (grams == NULL) {
+        return ALLOC_ERR;
+    }
+
+    for (size_t i = 0; i < hist.gram_cap; i++) {
+        Posting *old = &hist.grams[i];
+        if (old->key == 0) {
+            continue;
+        }
+        size_t j = (old->key * 2654435761u) & (new_cap - 1);
+        while (grams[j].key != 0) {
+            j = (j + 1) & (new_cap - 1);
+        }
+        grams[j] = *old;
+    }
+
+    free(hist.grams);
+    hist.grams    = grams;
+    hist.gram_cap = new_cap;
+    return OK;
+}
+
+static Posting* findGram(uint32_t key, int create) {
+    if (hist.gram_cap == 0 || (create && 2 * (hist.gram_count + 1) > hist.gram_cap)) {
+        if (!create || growGrams() != OK) {
+            return NULL;
+        }
+    }
+
+    size_t j = (key * 2654435761u) & (hist.gram_cap - 1);
+    while (hist.grams[j].key != 0) {
+        if (hist.grams[j].key == key) {
+            return &hist.grams[j];
+        }
+        j = (j + 1) & (hist.gram_cap - 1);
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    hist.grams[j].key = key;
+    hist.gram_count++;
+    return &hist.grams[j];
+}
+
+static CmdError indexEntry(size_t start, size_t end) {
+    for (size_t i = start; i + 3 <= end; i++) {
+        uint32_t key = (uint32_t)(unsigned char)hist.map[i] << 16 |
+                       (uint32_t)(unsigned char)hist.map[i + 1] << 8 |
+                       (uint32_t)(unsigned char)hist.map[i + 2];
+        key |= 1u << 24;   // keeps the key of "\0\0\0" away from the free-slot marker
+
+        Posting *p = findGram(key, 1);
+        if (p == NULL) {
+            return ALLOC_ERR;
+        }
+        if (p->count > 0 && p->offsets[p->count - 1] == start) {
+            continue;   // trigram repeated within the same entry
+        }
+        if (p->count == p->cap) {
+            uint32_t  new_cap = p->cap == 0 ? INITIAL_POSTING : p->cap * 2;
+            uint32_t *offsets = (uint32_t*)realloc(p->offsets, new_cap * sizeof(uint32_t));
+            if (offsets == NULL) {
+                return ALLOC_ERR;
+            }
+            p->offsets = offsets;
+            p->cap     = new_cap;
+        }
+        p->offsets[p->count++] = (uint32_t)start;
+    }
+    return OK;
+}
+
+// Indexes every complete entry past hist.indexed; a line still being written is left for later
+static CmdError syncIndex() {
+    CmdError err = syncMap();
+    if (err != OK) {
+        return err;
+    }
+
+    hist.indexing = 1;
+    while (hist.indexed < hist.map_size) {
+        size_t end = entryEnd(hist.indexed);
+        if (end == hist.map_size) {
+            break;
+        }
+        if ((err = indexEntry(hist.indexed, end)) != OK) {
+            return err;
+        }
+        hist.indexed = end + 1;
+    }
+    return OK;
+}
+
+static size_t entryEnd(size_t start) {
+    const char *nl = (const char*)memchr(hist.map + start, '\n', hist.map_size - start);
+    return nl != NULL ? (size_t)(nl - hist.map) : hist.map_size;
+}
+
+static size_t entryStart(size_t end) {
+    const char *nl = (const char*)memrchr(hist.map, '\n', end);
+    return nl != NULL ? (size_t)(nl - hist.map) + 1 : 0;
+}
+
+// Short needles have no trigram to look up: walk the entries backwards instead
+static size_t scanBack(const char *needle, size_t needle_len, size_t before) {
+    size_t end = before < hist.indexed ? before : hist.indexed;   // just past a newline
+    while (end > 0) {
+        size_t start = entryStart(end - 1);
+        if (memmem(hist.map + start, end - 1 - start, needle, needle_len) != NULL) {
+            return start;
+        }
+        end = start;
+    }
+    return NO_MATCH;
+}
+
+// Newest entry that starts before `before` and contains `needle`. Only entries that have
+// every trigram of the needle can match, so just the shortest posting list is checked.
+const char* HistoryFind(const char *needle, size_t before, size_t *len, size_t *pos) {
+    assert(needle);
+    assert(len);
+    assert(pos);
+
+    if (hist.fd == -1 || syncIndex() != OK) {
+        return NULL;
+    }
+
+    size_t needle_len = strlen(needle);
+    size_t found      = NO_MATCH;
+
+    if (needle_len < 3) {
+        found = scanBack(needle, needle_len, before);
+    }
+    else {
+        Posting *best = NULL;
+        for (size_t i = 0; i + 3 <= needle_len; i++) {
+            uint32_t key = (uint32_t)(unsigned char)needle[i] << 16 |
+                           (uint32_t)(unsigned char)needle[i + 1] << 8 |
+                           (uint32_t)(unsigned char)needle[i + 2] | 1u << 24;
+            Posting *p = findGram(key, 0);
+            if (p == NULL) {
+                return NULL;
+            }
+            if (best == NULL || p->count < best->count) {
+                best = p;
+            }
+        }
+
+        for (size_t i = best->count; i-- > 0 && found == NO_MATCH; ) {
+            size_t start = best->offsets[i];
+            if (start >= before) {
+                continue;
+            }
+            size_t end = entryEnd(start);
+            if (memmem(hist.map + start, end - start, needle, needle_len) != NULL) {
+                found = start;
+            }
+        }
+    }
+
+    if (found == NO_MATCH) {
+        return NULL;
+    }
+    *pos = found;
+    *len = entryEnd(found) - found;
+    return hist.map + found;
+}
+
+// The last `count` entries, found from the end of the file without reading the rest
+static void printTail(size_t count) {
+    if (hist.map_size == 0) {
+        return;
+    }
+
+    size_t end = hist.map_size;
+    if (end > 0 && hist.map[end - 1] != '\n') {
+        end = entryStart(end);   // partial line from a concurrent writer
+    }
+
+    size_t start = end;
+    for (size_t n = 0; n < count && start > 0; n++) {
+        start = entryStart(start - 1);
+    }
+    fwrite(hist.map + start, 1, end - start, stdout);
+}
+
+static void printMatches(const char *needle, int newest_first) {
+    size_t  before  = SIZE_MAX;
+    size_t  len     = 0;
+    size_t  pos     = 0;
+    size_t  count   = 0;
+    size_t  cap     = 0;
+    size_t *matches = NULL;
+
+    const char *entry = NULL;
+    while ((entry = HistoryFind(needle, before, &len, &pos)) != NULL) {
+        if (newest_first) {
+            printf("%.*s\n", (int)len, entry);
+        }
+        else {
+            if (count == cap) {
+                cap = cap == 0 ? 64 : cap * 2;
+                size_t *grown = (size_t*)realloc(matches, cap * sizeof(size_t));
+                if (grown == NULL) {
+                    break;
+                }
+                matches = grown;
+            }
+            matches[count++] = pos;
+        }
+        before = pos;
+    }
+
+    for (size_t i = count; i-- > 0; ) {
+        size_t end = entryEnd(matches[i]);
+        printf("%.*s\n", (int)(end - matches[i]), hist.map + matches[i]);
+    }
+    free(matches);
+}
+
+// history [N]   last N entries (all of them without N)
+// history -g S  entries containing S, oldest first, like 'history | grep S'
+// history -r S  the same, newest first, like reverse search
+int HistoryBuiltin(Command *cmd) {
+    assert(cmd);
+
+    if (hist.fd == -1 || syncMap() != OK) {
+        fprintf(stderr, "shell: history: no history file\n");
+        return 1;
+    }
+
+    if (cmd->argc == 3 && (strcmp(cmd->argv[1], "-g") == 0 || strcmp(cmd->argv[1], "-r") == 0)) {
+        printMatches(cmd->argv[2], cmd->argv[1][1] == 'r');
+        return 0;
+    }
+    if (cmd->argc > 2) {
+        fprintf(stderr, "Usage: history [N] | history -g text | history -r text\n");
+        return 2;
+    }
+
+    size_t count = SIZE_MAX;
+    if (cmd->argc == 2) {
+        char *end = NULL;
+        count = strtoul(cmd->argv[1], &end, 10);
+        if (end == cmd->argv[1] || *end != '\0') {
+            fprintf(stderr, "shell: history: %s: numeric argument required\n", cmd->argv[1]);
+            return 2;
+        }
+    }
+    printTail(count);
+    return 0;
+}
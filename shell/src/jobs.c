@@ -0,0 +1,495 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "jobs.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_EVENTS        32
+#define POLL_FALLBACK_MS  20   // used only for children without a pidfd (pre-5.3 kernels)
+#define NO_STATUS         -1
+
+typedef struct {
+    Job    *job;
+    size_t stage;
+    int    pidfd;   // -1 when pidfd_open() is unavailable
+} Proc;
+
+struct Job {
+    Job    *next;
+    int    id;
+    int    background;
+    int    notified;
+    size_t nprocs;
+    size_t running;
+    Proc        *procs;
+    StageTiming *stages;  // pid is -1 if the stage never started, status is $?-style
+    char        *text;
+};
+
+static int  epoll_fd  = -1;
+static Job *job_list  = NULL;
+static int  next_id   = 1;
+static int  unwatched = 0;   // children we have to poll for
+static int  announce  = 1;   // job control messages, off when running a script
+
+static char* describeLine(CommandLine *cline);
+static int   pidfdOpen   (pid_t pid);
+static void  reapProc    (Proc *proc);
+static void  pollEvents  (int timeout_ms, int *input_ready);
+static int   jobStatus   (Job *job);
+static void  freeJob     (Job *job);
+static Job*  findJob     (const char *spec);
+static void  unlinkJob   (Job *job);
+
+CmdError JobsInit(int interactive) {
+    announce = interactive;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return epoll_fd == -1 ? ALLOC_ERR : OK;
+}
+
+// A forked builtin must not share the shell's epoll set: it would register its own
+// children in it and consume the shell's events.
+void JobsAfterFork() {
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+    epoll_fd  = epoll_create1(EPOLL_CLOEXEC);
+    job_list  = NULL;   // those are the shell's children, not ours
+    unwatched = 0;
+}
+
+void JobsShutdown() {
+    while (job_list != NULL) {
+        Job *next = job_list->next;
+        freeJob(job_list);
+        job_list = next;
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+
+static int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static char* describeLine(CommandLine *cline) {
+    size_t len = 1;
+    for (size_t i = 0; i < cline->cmd_count; i++) {
+        for (size_t j = 0; j < cline->cmds[i].argc; j++) {
+            len += strlen(cline->cmds[i].argv[j]) + 1;
+        }
+        len += 3;
+    }
+
+    char *text = (char*)calloc(len, sizeof(char));
+    if (text == NULL) {
+        return NULL;
+    }
+
+    char *p = text;
+    for (size_t i = 0; i < cline->cmd_count; i++) {
+        if (i > 0) {
+            p = stpcpy(p, cline->cmds[i - 1].buffer_out ? "|> " : "| ");
+        }
+        for (size_t j = 0; j < cline->cmds[i].argc; j++) {
+            p = stpcpy(p, cline->cmds[i].argv[j]);
+            p = stpcpy(p, " ");
+        }
+    }
+    if (p > text) {
+        p[-1] = '\0';
+    }
+    return text;
+}
+
+Job* JobCreate(CommandLine *cline) {
+    assert(cline);
+
+    Job *job = (Job*)calloc(1, sizeof(Job));
+    if (job == NULL) {
+        return NULL;
+    }
+
+    // Every '|>' adds a buffer stage of its own after the command that feeds it
+    size_t nprocs = cline->cmd_count;
+    for (size_t i = 0; i < cline->cmd_count; i++) {
+        nprocs += cline->cmds[i].buffer_out ? 1 : 0;
+    }
+
+    job->procs  = (Proc*)calloc(nprocs, sizeof(Proc));
+    job->stages = (StageTiming*)calloc(nprocs, sizeof(StageTiming));
+    job->text   = describeLine(cline);
+    if (job->procs == NULL || job->stages == NULL || job->text == NULL) {
+        freeJob(job);
+        return NULL;
+    }
+
+    job->nprocs = nprocs;
+    for (size_t i = 0, cmd = 0; i < job->nprocs; i++, cmd++) {
+        job->procs[i].job     = job;
+        job->procs[i].stage   = i;
+        job->procs[i].pidfd   = -1;
+        job->stages[i].name   = cline->cmds[cmd].argv[0];
+        job->stages[i].pid    = -1;
+        job->stages[i].status = NO_STATUS;
+
+        if (cline->cmds[cmd].buffer_out) {
+            i++;
+            job->procs[i].job     = job;
+            job->procs[i].stage   = i;
+            job->procs[i].pidfd   = -1;
+            job->stages[i].name   = "|>";
+            job->stages[i].pid    = -1;
+            job->stages[i].status = NO_STATUS;
+        }
+    }
+    return job;
+}
+
+void JobStageStarting(Job *job, size_t stage) {
+    assert(job);
+    assert(stage < job->nprocs);
+
+    TimingNow(&job->stages[stage].start);
+    job->stages[stage].end = job->stages[stage].start;
+}
+
+void JobAddPid(Job *job, size_t stage, pid_t pid) {
+    assert(job);
+    assert(stage < job->nprocs);
+
+    Proc *proc = &job->procs[stage];
+    job->stages[stage].pid = pid;
+    proc->pidfd = pidfdOpen(pid);
+    job->running++;
+
+    if (proc->pidfd != -1) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = proc};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, proc->pidfd, &ev) == 0) {
+            return;
+        }
+        close(proc->pidfd);
+        proc->pidfd = -1;
+    }
+    unwatched++;
+}
+
+static void reapProc(Proc *proc) {
+    StageTiming *t      = &proc->job->stages[proc->stage];
+    int          status = 0;
+    if (wait4(t->pid, &status, WNOHANG, &t->usage) <= 0) {
+        return;
+    }
+
+    TimingNow(&t->end);
+    t->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (proc->pidfd != -1) {
+        // A forked builtin may still hold a copy of the pidfd, and epoll only forgets
+        // a descriptor once every copy is closed
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, proc->pidfd, NULL);
+        close(proc->pidfd);
+        proc->pidfd = -1;
+    }
+    else {
+        unwatched--;
+    }
+    proc->job->running--;
+}
+
+// One round of the event loop: reap whatever exited, and report whether the input is readable.
+static void pollEvents(int timeout_ms, int *input_ready) {
+    if (unwatched > 0 && (timeout_ms < 0 || timeout_ms > POLL_FALLBACK_MS)) {
+        timeout_ms = POLL_FALLBACK_MS;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.ptr == NULL) {
+            *input_ready = 1;
+        }
+        else {
+            reapProc((Proc*)events[i].data.ptr);
+        }
+    }
+
+    if (unwatched > 0) {
+        for (Job *job = job_list; job != NULL; job = job->next) {
+            for (size_t i = 0; i < job->nprocs; i++) {
+                if (job->stages[i].pid != -1 && job->procs[i].pidfd == -1 &&
+                    job->stages[i].status == NO_STATUS) {
+                    reapProc(&job->procs[i]);
+                }
+            }
+        }
+    }
+}
+
+static int jobStatus(Job *job) {
+    int status = job->stages[job->nprocs - 1].status;
+    return status == NO_STATUS ? 127 : status;
+}
+
+// Foreground wait: returns the last stage's status. The caller releases the job.
+int JobWait(Job *job) {
+    assert(job);
+
+    job->next = job_list;
+    job_list  = job;
+
+    int ignored = 0;
+    while (job->running > 0) {
+        pollEvents(-1, &ignored);
+    }
+
+    int status = jobStatus(job);
+    unlinkJob(job);
+    return status;
+}
+
+// Waits until any of the given foreground jobs is finished and returns its index;
+// that job is left to the caller to release, the others keep running.
+size_t JobWaitAny(Job **jobs, size_t count, int *status) {
+    assert(jobs);
+    assert(status);
+    assert(count > 0);
+
+    for (size_t i = 0; i < count; i++) {
+        jobs[i]->next = job_list;
+        job_list      = jobs[i];
+    }
+
+    size_t done    = count;
+    int    ignored = 0;
+    while (1) {
+        for (size_t i = 0; i < count && done == count; i++) {
+            done = jobs[i]->running == 0 ? i : count;
+        }
+        if (done != count) {
+            break;
+        }
+        pollEvents(-1, &ignored);
+    }
+
+    *status = jobStatus(jobs[done]);
+    for (size_t i = 0; i < count; i++) {
+        unlinkJob(jobs[i]);
+    }
+    return done;
+}
+
+static void unlinkJob(Job *job) {
+    for (Job **link = &job_list; *link != NULL; link = &(*link)->next) {
+        if (*link == job) {
+            *link = job->next;
+            break;
+        }
+    }
+}
+
+void JobRelease(Job *job) {
+    freeJob(job);
+}
+
+// Per-stage accounting of a finished foreground job; stage names point into its CommandLine.
+const StageTiming* JobStages(Job *job, size_t *count) {
+    assert(job);
+    assert(count);
+
+    for (size_t i = 0; i < job->nprocs; i++) {
+        if (job->stages[i].status == NO_STATUS) {
+            job->stages[i].status = 127;  // never started
+        }
+    }
+
+    *count = job->nprocs;
+    return job->stages;
+}
+
+// Leaves the job running in the background; it is reported by JobsNotify() once done.
+void JobDetach(Job *job) {
+    assert(job);
+
+    job->background = 1;
+    job->id         = next_id++;
+
+    // Names point into a CommandLine that is about to be reused
+    for (size_t i = 0; i < job->nprocs; i++) {
+        job->stages[i].name = NULL;
+    }
+    job->next       = job_list;
+    job_list        = job;
+
+    pid_t last = -1;
+    for (size_t i = 0; i < job->nprocs; i++) {
+        if (job->stages[i].pid != -1) {
+            last = job->stages[i].pid;
+        }
+    }
+    if (announce) {
+        printf("[%d] %d\n", job->id, (int)last);
+    }
+}
+
+void JobsNotify() {
+    int ignored = 0;
+    pollEvents(0, &ignored);
+
+    Job **link = &job_list;
+    while (*link != NULL) {
+        Job *job = *link;
+        if (job->background && job->running == 0) {
+            int status = jobStatus(job);
+            if (job->notified || !announce) {
+                // already reported through wait, or nobody to tell
+            }
+            else if (status == 0) {
+                printf("[%d]+  Done                    %s\n", job->id, job->text);
+            }
+            else {
+                printf("[%d]+  Exit %-3d                %s\n", job->id, status, job->text);
+            }
+            *link = job->next;
+            freeJob(job);
+            continue;
+        }
+        link = &job->next;
+    }
+
+    if (job_list == NULL) {
+        next_id = 1;
+    }
+    fflush(stdout);
+}
+
+// Blocks until fd is readable, reaping children in the meantime. Returns 1 if any
+// background job finished while we were waiting (the caller may want to redraw).
+int JobsWaitInput(int fd) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    int watch_input = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    int finished    = 0;
+
+    // Regular files cannot be polled: they are always readable anyway
+    if (!watch_input) {
+        return 0;
+    }
+
+    int ready = 0;
+    while (!ready) {
+        pollEvents(-1, &ready);
+
+        for (Job *job = job_list; job != NULL; job = job->next) {
+            if (job->background && job->running == 0) {
+                finished = 1;
+            }
+        }
+        if (finished) {
+            break;
+        }
+    }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    return finished;
+}
+
+static void freeJob(Job *job) {
+    if (job == NULL) return;
+
+    for (size_t i = 0; i < job->nprocs && job->procs != NULL; i++) {
+        if (job->procs[i].pidfd != -1) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, job->procs[i].pidfd, NULL);
+            close(job->procs[i].pidfd);
+        }
+    }
+    free(job->procs);
+    free(job->stages);
+    free(job->text);
+    free(job);
+}
+
+static Job* findJob(const char *spec) {
+    char *end = NULL;
+
+    if (spec[0] == '%') {
+        long id = strtol(spec + 1, &end, 10);
+        for (Job *job = job_list; job != NULL; job = job->next) {
+            if (job->background && job->id == id) {
+                return job;
+            }
+        }
+        return NULL;
+    }
+
+    long pid = strtol(spec, &end, 10);
+    for (Job *job = job_list; job != NULL; job = job->next) {
+        for (size_t i = 0; i < job->nprocs; i++) {
+            if (job->background && job->stages[i].pid == pid) {
+                return job;
+            }
+        }
+    }
+    return NULL;
+}
+
+int JobsBuiltin(Command *cmd) {
+    (void)cmd;
+
+    int ignored = 0;
+    pollEvents(0, &ignored);
+
+    for (Job *job = job_list; job != NULL; job = job->next) {
+        if (!job->background) {
+            continue;
+        }
+        printf("[%d]  %-22s  %s\n", job->id, job->running > 0 ? "Running" : "Done", job->text);
+    }
+    return 0;
+}
+
+// wait          wait for every background job
+// wait %N|PID   wait for one job, return its status
+int WaitBuiltin(Command *cmd) {
+    int ignored = 0;
+    int status  = 0;
+
+    if (cmd->argc == 1) {
+        for (Job *job = job_list; job != NULL; job = job->next) {
+            while (job->background && job->running > 0) {
+                pollEvents(-1, &ignored);
+            }
+            job->notified = 1;
+        }
+        JobsNotify();
+        return 0;
+    }
+
+    for (size_t i = 1; i < cmd->argc; i++) {
+        Job *job = findJob(cmd->argv[i]);
+        if (job == NULL) {
+            fprintf(stderr, "shell: wait: %s: no such job\n", cmd->argv[i]);
+            status = 127;
+            continue;
+        }
+        while (job->running > 0) {
+            pollEvents(-1, &ignored);
+        }
+        status = jobStatus(job);
+        job->notified = 1;
+    }
+    JobsNotify();
+    return status;
+}
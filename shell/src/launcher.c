@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "jobs.h"
+#include "launcher.h"
+#include "pipe_buffer.h"
+#include "variables.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define CLONE_STACK_SIZE (64 * 1024)
+#define EXEC_FAIL_CODE   127
+#define REDIR_FAIL_CODE  1
+#define SAVED_FD_MIN     10
+#define SCRIPT_ARGS_MAX  1024   // argv of a '#!'-less script run through /bin/sh from a child
+
+typedef struct {
+    const char    *path;
+    Command       *cmd;
+    char          **envp;
+    const StageIo *io;
+} CloneArgs;
+
+// errno of a failed exec, written by a vfork/clone child that shares our memory
+static volatile int exec_errno = 0;
+
+static const char *LAUNCH_NAMES[] = {
+    [LAUNCH_FORK]  = "fork",
+    [LAUNCH_VFORK] = "vfork",
+    [LAUNCH_CLONE] = "clone",
+    [LAUNCH_SPAWN] = "spawn",
+};
+
+// The parent is suspended while a CLONE_VFORK child runs, so one stack is enough.
+static char clone_stack[CLONE_STACK_SIZE] __attribute__((aligned(16)));
+
+// ASan cannot track the switch onto clone_stack, so the child side runs uninstrumented.
+#define CHILD_SIDE __attribute__((no_sanitize_address))
+
+static void  applyIo   (const StageIo *io) CHILD_SIDE;
+static int   applyRedirects(const Command *cmd) CHILD_SIDE;
+static void  childError(const char *what, const char *fallback) CHILD_SIDE;
+static int   redirectFlags(RedirKind kind);
+static int   fromFd    (RedirKind kind) CHILD_SIDE;
+static int   bodyFd    (const char *body, size_t len, int newline);
+static void  execStage (const char *path, Command *cmd, char **envp, const StageIo *io, int err_fd) CHILD_SIDE __attribute__((noreturn));
+static int   cloneEntry(void *arg) CHILD_SIDE;
+static pid_t spawnStage(const char *path, Command *cmd, char **envp, const StageIo *io);
+
+CmdError ParseLaunchMode(const char *name, LaunchMode *mode) {
+    assert(name);
+    assert(mode);
+
+    for (size_t i = 0; i < sizeof(LAUNCH_NAMES) / sizeof(LAUNCH_NAMES[0]); i++) {
+        if (strcmp(name, LAUNCH_NAMES[i]) == 0) {
+            *mode = (LaunchMode)i;
+            return OK;
+        }
+    }
+    return SYNTAX_ERR;
+}
+
+const char* LaunchModeName(LaunchMode mode) {
+    return LAUNCH_NAMES[mode];
+}
+
+// envp is handed to the program as it is: the shared snapshot, or one with the
+// command's own assignments laid over it. A child that cannot exec is reaped here and
+// -1 comes back with its errno, the same in every mode as posix_spawn() reports it.
+pid_t LaunchStage(LaunchMode mode, const char *path, Command *cmd, char **envp, const StageIo *io) {
+    assert(path);
+    assert(cmd);
+    assert(envp);
+    assert(io);
+
+    pid_t pid = -1;
+    exec_errno = 0;
+
+    switch (mode) {
+        case LAUNCH_FORK: {
+            // A forked child has memory of its own: the errno comes over a pipe that exec closes
+            int err_pipe[2] = {-1, -1};
+            if (pipe2(err_pipe, O_CLOEXEC) < 0) {
+                err_pipe[0] = err_pipe[1] = -1;
+            }
+            pid = fork();
+            if (pid == 0) {
+                execStage(path, cmd, envp, io, err_pipe[1]);
+            }
+            if (err_pipe[1] != -1) {
+                close(err_pipe[1]);
+                int err = 0;
+                if (pid > 0 && read(err_pipe[0], &err, sizeof(err)) == (ssize_t)sizeof(err)) {
+                    exec_errno = err;
+                }
+                close(err_pipe[0]);
+            }
+            break;
+        }
+
+        case LAUNCH_VFORK:
+            pid = vfork();
+            if (pid == 0) {
+                execStage(path, cmd, envp, io, -1);
+            }
+            break;
+
+        case LAUNCH_CLONE: {
+            CloneArgs args = {path, cmd, envp, io};
+            pid = clone(cloneEntry, clone_stack + CLONE_STACK_SIZE,
+                        CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+            break;
+        }
+
+        case LAUNCH_SPAWN:
+            return spawnStage(path, cmd, envp, io);
+
+        default:
+            return -1;
+    }
+
+    if (pid == -1) {
+        fprintf(stderr, "failed to create process\n");
+    }
+    else if (exec_errno != 0) {
+        waitpid(pid, NULL, 0);
+        errno = exec_errno;
+        return -1;
+    }
+    return pid;
+}
+
+// A builtin stage still needs its own process to sit in the pipeline, but it never execs,
+// so it always takes a real fork(): vfork/clone children may not touch stdio.
+pid_t LaunchBuiltin(const Builtin *builtin, Command *cmd, const StageIo *io) {
+    assert(builtin);
+    assert(cmd);
+    assert(io);
+
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        JobsAfterFork();
+        VarsApply(cmd->assigns, cmd->assign_count, 1);
+        applyIo(io);
+        if (applyRedirects(cmd) != 0) {
+            _exit(REDIR_FAIL_CODE);
+        }
+        int rc = builtin->fn(cmd);
+        fflush(NULL);
+        _exit(rc);
+    }
+
+    if (pid == -1) {
+        fprintf(stderr, "failed to create process\n");
+    }
+    return pid;
+}
+
+// The '|>' stage works on the pipe ends directly, stdin/stdout are left alone.
+pid_t LaunchPipeBuffer(size_t capacity, const StageIo *io) {
+    assert(io);
+
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (io->close_fd != -1) {
+            close(io->close_fd);
+        }
+        _exit(PumpPipeBuffer(io->in_fd, io->out_fd, capacity));
+    }
+
+    if (pid == -1) {
+        fprintf(stderr, "failed to create process\n");
+    }
+    return pid;
+}
+
+// Runs in a child that may share the parent's memory: only syscalls, no stdio, no malloc.
+static void applyIo(const StageIo *io) {
+    if (io->in_fd != -1) {
+        dup2(io->in_fd, STDIN_FILENO);   // Redirect stdin to read from previous pipe
+        close(io->in_fd);
+    }
+
+    if (io->out_fd != -1) {
+        dup2(io->out_fd, STDOUT_FILENO); // Redirect stdout to write to current pipe
+        close(io->out_fd);
+    }
+
+    if (io->close_fd != -1) {
+        close(io->close_fd);
+    }
+}
+
+static int redirectFlags(RedirKind kind) {
+    switch (kind) {
+        case REDIR_IN:     return O_RDONLY;
+        case REDIR_OUT:    return O_WRONLY | O_CREAT | O_TRUNC;
+        case REDIR_APPEND: return O_WRONLY | O_CREAT | O_APPEND;
+        case REDIR_DUP:
+        case REDIR_HEREDOC:
+        case REDIR_HERESTRING:
+        default:           return 0;
+    }
+}
+
+// These redirections dup an fd the parent already has open instead of opening a file
+static int fromFd(RedirKind kind) {
+    return kind == REDIR_DUP || kind == REDIR_HEREDOC || kind == REDIR_HERESTRING;
+}
+
+// A readable fd holding body: a memfd rewound to the start, so a body of any size is
+// written before the child even exists and nothing touches the disk. Without memfd_create()
+// a pipe does, as long as the body fits in the pipe buffer.
+static int bodyFd(const char *body, size_t len, int newline) {
+    static char  nl[] = "\n";
+    struct iovec iov[2] = {
+        {(char*)(uintptr_t)body, len},   // writev() only reads it
+        {nl, newline ? 1 : 0},
+    };
+    size_t total = len + (size_t)(newline != 0);
+
+    int fd = memfd_create("heredoc", MFD_CLOEXEC);
+    if (fd >= 0) {
+        if (writev(fd, iov, 2) == (ssize_t)total && lseek(fd, 0, SEEK_SET) == 0) {
+            return fd;
+        }
+        close(fd);
+        return -1;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        return -1;
+    }
+    int     fits = (size_t)fcntl(fds[1], F_GETPIPE_SZ) >= total;
+    ssize_t n    = fits ? writev(fds[1], iov, 2) : -1;
+    close(fds[1]);
+    if (n != (ssize_t)total) {
+        close(fds[0]);
+        errno = fits ? EIO : EFBIG;
+        return -1;
+    }
+    return fds[0];
+}
+
+// Heredoc and here-string bodies get their fds right before the stage starts,
+// and CloseHereDocs() drops the parent's copies once it has.
+CmdError OpenHereDocs(Command *cmd) {
+    assert(cmd);
+
+    for (size_t i = 0; i < cmd->redir_count; i++) {
+        Redirect *r = &cmd->redirs[i];
+        if (r->kind != REDIR_HEREDOC && r->kind != REDIR_HERESTRING) {
+            continue;
+        }
+        r->target_fd = bodyFd(r->target, strlen(r->target), r->kind == REDIR_HERESTRING);
+        if (r->target_fd < 0) {
+            fprintf(stderr, "shell: here-document: %s\n", strerror(errno));
+            CloseHereDocs(cmd);
+            return READ_ERR;
+        }
+    }
+    return OK;
+}
+
+void CloseHereDocs(Command *cmd) {
+    assert(cmd);
+
+    for (size_t i = 0; i < cmd->redir_count; i++) {
+        Redirect *r = &cmd->redirs[i];
+        if ((r->kind == REDIR_HEREDOC || r->kind == REDIR_HERESTRING) && r->target_fd >= 0) {
+            close(r->target_fd);
+            r->target_fd = -1;
+        }
+    }
+}
+
+// strerror() is not safe in a vfork child, so spell out the common cases
+static void childError(const char *what, const char *fallback) {
+    const char *reason = errno == ENOENT ? ": No such file or directory\n"
+                       : errno == EACCES ? ": Permission denied\n"
+                       : errno == EISDIR ? ": Is a directory\n"
+                       : errno == EBADF  ? ": Bad file descriptor\n"
+                       :                   fallback;
+    write(STDERR_FILENO, "shell: ", 7);
+    write(STDERR_FILENO, what, strlen(what));
+    write(STDERR_FILENO, reason, strlen(reason));
+}
+
+// Redirections come after the pipe ends, so '> file' wins over '|' like in sh
+static int applyRedirects(const Command *cmd) {
+    for (size_t i = 0; i < cmd->redir_count; i++) {
+        const Redirect *r = &cmd->redirs[i];
+
+        if (fromFd(r->kind)) {
+            if (dup2(r->target_fd, r->fd) < 0) {
+                childError(r->fd == STDERR_FILENO ? "2" : "redirection", ": cannot duplicate\n");
+                return -1;
+            }
+            continue;
+        }
+
+        int fd = open(r->target, redirectFlags(r->kind), 0666);
+        if (fd < 0) {
+            childError(r->target, ": cannot open\n");
+            return -1;
+        }
+        if (fd != r->fd) {
+            dup2(fd, r->fd);
+            close(fd);
+        }
+    }
+    return 0;
+}
+
+static void execStage(const char *path, Command *cmd, char **envp, const StageIo *io, int err_fd) {
+    applyIo(io);
+    if (applyRedirects(cmd) != 0) {
+        _exit(REDIR_FAIL_CODE);
+    }
+
+    execve(path, cmd->argv, envp);
+
+    // No '#!' line: a script for /bin/sh, which is what execvp() falls back to as well
+    if (errno == ENOEXEC && cmd->argc + 2 <= SCRIPT_ARGS_MAX) {
+        char *sh_argv[SCRIPT_ARGS_MAX];
+        sh_argv[0] = (char*)"/bin/sh";
+        sh_argv[1] = (char*)(uintptr_t)path;
+        memcpy(sh_argv + 2, cmd->argv + 1, cmd->argc * sizeof(char*));  // the rest and the NULL
+        execve("/bin/sh", sh_argv, envp);
+    }
+
+    int err = errno;
+    childError(cmd->argv[0], ": cannot execute\n");
+    exec_errno = err;
+    if (err_fd != -1) {
+        write(err_fd, &err, sizeof(err));
+    }
+    _exit(EXEC_FAIL_CODE);
+}
+
+// A builtin run by the shell itself gets its redirections applied in place;
+// the shell's own descriptors are parked above SAVED_FD_MIN and put back afterwards.
+CmdError RedirectShell(const Command *cmd, SavedFd **saved, size_t *nsaved) {
+    assert(cmd);
+    assert(saved);
+    assert(nsaved);
+
+    *saved  = NULL;
+    *nsaved = 0;
+    if (cmd->redir_count == 0) {
+        return OK;
+    }
+
+    *saved = (SavedFd*)calloc(cmd->redir_count, sizeof(SavedFd));
+    if (*saved == NULL) {
+        return ALLOC_ERR;
+    }
+
+    fflush(NULL);
+    for (size_t i = 0; i < cmd->redir_count; i++) {
+        const Redirect *r = &cmd->redirs[i];
+
+        int already = 0;
+        for (size_t j = 0; j < *nsaved; j++) {
+            already |= (*saved)[j].fd == r->fd;
+        }
+        if (!already) {
+            (*saved)[*nsaved].fd    = r->fd;
+            (*saved)[*nsaved].saved = fcntl(r->fd, F_DUPFD_CLOEXEC, SAVED_FD_MIN);
+            (*nsaved)++;
+        }
+
+        int dup = fromFd(r->kind);
+        int fd  = dup ? r->target_fd : open(r->target, redirectFlags(r->kind) | O_CLOEXEC, 0666);
+        if (fd < 0 || (fd != r->fd && dup2(fd, r->fd) < 0)) {
+            fprintf(stderr, "shell: %s: %s\n", dup ? "redirection" : r->target, strerror(errno));
+            if (fd >= 0 && !dup) {
+                close(fd);
+            }
+            RestoreShell(*saved, *nsaved);
+            *saved  = NULL;
+            *nsaved = 0;
+            return READ_ERR;
+        }
+        if (!dup && fd != r->fd) {
+            close(fd);
+        }
+    }
+    return OK;
+}
+
+void RestoreShell(SavedFd *saved, size_t nsaved) {
+    fflush(NULL);
+    for (size_t i = nsaved; i-- > 0; ) {
+        if (saved[i].saved == -1) {
+            close(saved[i].fd);  // it was closed before the redirection
+            continue;
+        }
+        dup2(saved[i].saved, saved[i].fd);
+        close(saved[i].saved);
+    }
+    free(saved);
+}
+
+static int cloneEntry(void *arg) {
+    CloneArgs *args = (CloneArgs*)arg;
+    execStage(args->path, args->cmd, args->envp, args->io, -1);
+}
+
+static pid_t spawnStage(const char *path, Command *cmd, char **envp, const StageIo *io) {
+    posix_spawn_file_actions_t actions;
+    if (posix_spawn_file_actions_init(&actions) != 0) {
+        return -1;
+    }
+
+    if (io->in_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, io->in_fd, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, io->in_fd);
+    }
+
+    if (io->out_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, io->out_fd, STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, io->out_fd);
+    }
+
+    if (io->close_fd != -1) {
+        posix_spawn_file_actions_addclose(&actions, io->close_fd);
+    }
+
+    for (size_t i = 0; i < cmd->redir_count; i++) {
+        const Redirect *r = &cmd->redirs[i];
+        if (fromFd(r->kind)) {
+            posix_spawn_file_actions_adddup2(&actions, r->target_fd, r->fd);
+        }
+        else {
+            posix_spawn_file_actions_addopen(&actions, r->fd, r->target, redirectFlags(r->kind), 0666);
+        }
+    }
+
+    pid_t pid = -1;
+    int   err = posix_spawn(&pid, path, &actions, NULL, cmd->argv, envp);
+    char **sh_argv = err == ENOEXEC ? (char**)malloc((cmd->argc + 2) * sizeof(char*)) : NULL;
+    if (sh_argv != NULL) {  // a script without '#!', see execStage()
+        sh_argv[0] = (char*)"/bin/sh";
+        sh_argv[1] = (char*)(uintptr_t)path;
+        memcpy(sh_argv + 2, cmd->argv + 1, cmd->argc * sizeof(char*));
+        err = posix_spawn(&pid, "/bin/sh", &actions, NULL, sh_argv, envp);
+        free(sh_argv);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err != 0) {
+        // posix_spawn() does not say which step failed; name the input file if that was it
+        const char *what = cmd->argv[0];
+        for (size_t i = 0; i < cmd->redir_count; i++) {
+            if (cmd->redirs[i].kind == REDIR_IN && access(cmd->redirs[i].target, R_OK) != 0) {
+                what = cmd->redirs[i].target;
+                break;
+            }
+        }
+        fprintf(stderr, "shell: %s: %s\n", what, strerror(err));
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
@@ -1,31 +1,210 @@
+#include "builtins.h"
 #include "command_parser.h"
 #include "common.h"
+#include "history.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "path_cache.h"
+#include "pipe_buffer.h"
+#include "plan_cache.h"
 #include "run_cmd.h"
+#include "variables.h"
 
-int main()
+#include <fcntl.h>
+#include <unistd.h>
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-l fork|vfork|clone|spawn] [-T] [-R timing.jsonl] "
+                    "[-P pipe_size] [-B buffer_size] [-c command | -f script]\n", prog);
+}
+
+// Accepts plain bytes or a K/M/G suffix
+static CmdError parseSize(const char *str, size_t *size)
+{
+    char *end = NULL;
+    unsigned long long val = strtoull(str, &end, 10);
+    if (end == str)
+    {
+        return SYNTAX_ERR;
+    }
+
+    switch (*end)
+    {
+        case 'G': case 'g': val <<= 10; // fall through
+        case 'M': case 'm': val <<= 10; // fall through
+        case 'K': case 'k': val <<= 10; end++; break;
+        case '\0': break;
+        default: return SYNTAX_ERR;
+    }
+    if (*end != '\0')
+    {
+        return SYNTAX_ERR;
+    }
+
+    *size = (size_t)val;
+    return OK;
+}
+
+int main(int argc, char *argv[], char *envp[])
 {
-    char *string_cmd = ReadCmd();
-    if (string_cmd == NULL) 
+    RunOptions opts = {
+        .launcher    = LAUNCH_SPAWN,
+        .timing      = 0,
+        .timing_log  = NULL,
+        .pipe_size   = 0,
+        .buffer_size = PIPE_BUFFER_DEFAULT,
+    };
+
+    const char *command = NULL;
+    const char *script  = NULL;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "l:TR:P:B:c:f:")) != -1)
     {
-        fprintf(stderr, "failed read cmd string\n");
+        switch (opt)
+        {
+            case 'l':
+                if (ParseLaunchMode(optarg, &opts.launcher) != OK)
+                {
+                    fprintf(stderr, "unknown launcher '%s'\n", optarg);
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'T':
+                opts.timing = 1;
+                break;
+            case 'R':
+                opts.timing_log = fopen(optarg, "ae");
+                if (opts.timing_log == NULL)
+                {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+            case 'B':
+                if (parseSize(optarg, opt == 'P' ? &opts.pipe_size : &opts.buffer_size) != OK)
+                {
+                    fprintf(stderr, "bad size '%s'\n", optarg);
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                command = optarg;
+                break;
+            case 'f':
+                script = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    ParallelInit(&opts);
+
+    if (VarsInit(envp) != OK)
+    {
+        fprintf(stderr, "failed to import the environment\n");
         return 1;
     }
 
-    CommandLine *cline = InitCommandLine();
-    CmdError err = ParseCommandLine(string_cmd, cline);
-    if (err != OK) 
+    // A script or -c text runs without prompts or job messages, as does a piped stdin
+    int interactive = command == NULL && script == NULL && isatty(STDIN_FILENO);
+    if (command != NULL)
     {
-        fprintf(stderr, "ParseCommandLine failed with error %u\n", err);
+        if (ReadCmdInitString(command) != OK)
+        {
+            fprintf(stderr, "failed to allocate command line\n");
+            return 1;
+        }
+    }
+    else if (script != NULL)
+    {
+        int fd = open(script, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            perror(script);
+            return 127;
+        }
+        ReadCmdInit(fd, 0);
+    }
+    else
+    {
+        ReadCmdInit(STDIN_FILENO, interactive);
+    }
+
+    // Only an interactive shell records lines, but scripts may still query the history
+    HistoryOpen(interactive);
+
+    if (JobsInit(interactive) != OK)
+    {
+        fprintf(stderr, "failed to set up child reaping\n");
         return 1;
     }
-    free(string_cmd);
-    
-    #if 0
-    PrintCommandLineTable(cline);
-    #endif
 
-    RunCmd(cline);
+    // Parsed lines are kept by text, so a loop body or a repeated command is parsed once
+    if (PlanCacheInit(PLAN_CACHE_DEFAULT) != OK)
+    {
+        fprintf(stderr, "failed to allocate command line\n");
+        return 1;
+    }
 
-    FreeCommandLine(cline);
-    return 0;
+    char    *string_cmd = NULL;
+    size_t  cmd_cap     = 0;
+    int     exit_code   = 0;
+    ssize_t len         = 0;
+    while ((len = ReadCmd(&string_cmd, &cmd_cap)) >= 0)
+    {
+        if (interactive)
+        {
+            HistoryAdd(string_cmd, (size_t)len);
+        }
+
+        CommandLine *cline = NULL;
+        CmdError err = PlanCacheGet(string_cmd, strlen(string_cmd), &cline);
+        if (err == OK && cline->heredocs > 0)
+        {
+            err = ReadCmdHeredocs(cline);
+        }
+        if (err != OK)
+        {
+            fprintf(stderr, "ParseCommandLine failed with error %u\n", err);
+            exit_code = 2;
+            VarsSetStatus(exit_code);
+            continue;
+        }
+
+        #if 0
+        PrintCommandLineTable(cline);
+        #endif
+
+        if (cline->cmd_count > 0)
+        {
+            exit_code = RunCmd(cline, &opts);
+            VarsSetStatus(exit_code);
+        }
+        JobsNotify();
+
+        if (ShellExitRequested(&exit_code))
+        {
+            break;
+        }
+    }
+
+    free(string_cmd);
+    ReadCmdFree();
+    PlanCacheFree();
+    HistoryClose();
+    VarsFree();
+    PathCacheClear();
+    JobsShutdown();
+    if (opts.timing_log != NULL)
+    {
+        fclose(opts.timing_log);
+    }
+    return exit_code;
 }
@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "jobs.h"
+#include "parallel.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+#define INPUT_SEPARATOR ":::"
+#define PLACEHOLDER     "{}"
+#define MAX_FAIL_CODE   101   // like GNU parallel: the number of failed jobs, capped
+
+typedef struct {
+    Command     cmd;
+    CommandLine cline;    // one-command line around cmd, never parsed
+    Job         *job;     // NULL while the slot is free
+    int         out_fd;   // memfd collecting the job's stdout, -1 to write straight through
+} Slot;
+
+static const RunOptions *run_opts = NULL;
+
+static int    parseJobs   (Command *cmd, size_t *pos, size_t *jobs);
+static void   fillArgv    (char **argv, char **tmpl, size_t tmpl_len, char *input);
+static void   flushOutput (int fd);
+
+void ParallelInit(const RunOptions *opts) {
+    assert(opts);
+
+    run_opts = opts;
+}
+
+static int parseJobs(Command *cmd, size_t *pos, size_t *jobs) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    *jobs = cpus > 0 ? (size_t)cpus : 1;
+
+    if (*pos < cmd->argc && strncmp(cmd->argv[*pos], "-j", 2) == 0) {
+        const char *val = cmd->argv[*pos][2] != '\0' ? cmd->argv[*pos] + 2 : cmd->argv[++(*pos)];
+        char *end = NULL;
+        unsigned long n = val != NULL ? strtoul(val, &end, 10) : 0;
+        if (val == NULL || end == val || *end != '\0' || n == 0) {
+            fprintf(stderr, "shell: parallel: bad job count\n");
+            return -1;
+        }
+        *jobs = (size_t)n;
+        (*pos)++;
+    }
+    return 0;
+}
+
+static void fillArgv(char **argv, char **tmpl, size_t tmpl_len, char *input) {
+    int replaced = 0;
+    for (size_t i = 0; i < tmpl_len; i++) {
+        if (strcmp(tmpl[i], PLACEHOLDER) == 0) {
+            argv[i]  = input;
+            replaced = 1;
+        }
+        else {
+            argv[i] = tmpl[i];
+        }
+    }
+
+    argv[tmpl_len]     = replaced ? NULL : input;
+    argv[tmpl_len + 1] = NULL;
+}
+
+// The job wrote through its own copy of the descriptor, so the shared offset is its size
+static void flushOutput(int fd) {
+    off_t size = lseek(fd, 0, SEEK_CUR);
+    if (size <= 0) {
+        return;
+    }
+
+    off_t offset = 0;
+    while (offset < size) {
+        ssize_t n = sendfile(STDOUT_FILENO, fd, &offset, (size_t)(size - offset));
+        if (n > 0) {
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // stdout that sendfile() cannot write to (pre-5.12 kernels): plain copy
+        char buf[BUFSIZ];
+        ssize_t got = pread(fd, buf, sizeof(buf), offset);
+        if (got <= 0 || write(STDOUT_FILENO, buf, (size_t)got) != got) {
+            break;
+        }
+        offset += got;
+    }
+
+    ftruncate(fd, 0);
+    lseek(fd, 0, SEEK_SET);
+}
+
+// Job slots are refilled as soon as any job finishes, so N jobs are running for as long as
+// there are inputs left. Output comes out per job, in the order the jobs finish.
+int ParallelBuiltin(Command *cmd) {
+    assert(cmd);
+    assert(run_opts);
+
+    size_t pos   = 1;
+    size_t njobs = 0;
+    if (parseJobs(cmd, &pos, &njobs) != 0) {
+        return 2;
+    }
+
+    size_t sep = pos;
+    while (sep < cmd->argc && strcmp(cmd->argv[sep], INPUT_SEPARATOR) != 0) {
+        sep++;
+    }
+    if (sep == pos || sep == cmd->argc) {
+        fprintf(stderr, "Usage: parallel [-j N] command [args...] ::: input...\n");
+        return 2;
+    }
+
+    char   **tmpl     = cmd->argv + pos;
+    size_t tmpl_len   = sep - pos;
+    char   **inputs   = cmd->argv + sep + 1;
+    size_t ninputs    = cmd->argc - sep - 1;
+    if (ninputs == 0) {
+        return 0;
+    }
+    if (njobs > ninputs) {
+        njobs = ninputs;
+    }
+
+    Slot  *slots   = (Slot*)calloc(njobs, sizeof(Slot));
+    Job  **running = (Job**)calloc(njobs, sizeof(Job*));
+    char **argvs   = (char**)calloc(njobs * (tmpl_len + 2), sizeof(char*));
+    if (slots == NULL || running == NULL || argvs == NULL) {
+        free(slots);
+        free(running);
+        free(argvs);
+        fprintf(stderr, "failed to allocate job\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < njobs; i++) {
+        slots[i].cmd.argv        = argvs + i * (tmpl_len + 2);
+        slots[i].cline.cmds      = &slots[i].cmd;
+        slots[i].cline.cmd_count = 1;
+        slots[i].out_fd          = memfd_create("parallel", MFD_CLOEXEC);
+    }
+
+    fflush(stdout);
+
+    size_t next   = 0;
+    size_t active = 0;
+    size_t failed = 0;
+    while (next < ninputs || active > 0) {
+        // Fill every free slot first, then sleep until one of the jobs is done
+        for (size_t i = 0; i < njobs && next < ninputs; i++) {
+            Slot *slot = &slots[i];
+            if (slot->job != NULL) {
+                continue;
+            }
+
+            fillArgv(slot->cmd.argv, tmpl, tmpl_len, inputs[next++]);
+            slot->cmd.argc = tmpl_len + (slot->cmd.argv[tmpl_len] != NULL ? 1 : 0);
+
+            slot->job = StartPipeline(&slot->cline, run_opts, slot->out_fd);
+            if (slot->job == NULL) {
+                failed++;
+                continue;
+            }
+            active++;
+        }
+
+        if (active == 0) {
+            continue;
+        }
+
+        size_t count = 0;
+        for (size_t i = 0; i < njobs; i++) {
+            if (slots[i].job != NULL) {
+                running[count++] = slots[i].job;
+            }
+        }
+
+        int    status = 0;
+        size_t done   = JobWaitAny(running, count, &status);
+        for (size_t i = 0; i < njobs; i++) {
+            if (slots[i].job != running[done]) {
+                continue;
+            }
+            if (slots[i].out_fd != -1) {
+                flushOutput(slots[i].out_fd);
+            }
+            JobRelease(slots[i].job);
+            slots[i].job = NULL;
+            break;
+        }
+
+        failed += status != 0 ? 1 : 0;
+        active--;
+    }
+
+    for (size_t i = 0; i < njobs; i++) {
+        if (slots[i].out_fd != -1) {
+            close(slots[i].out_fd);
+        }
+    }
+    free(slots);
+    free(running);
+    free(argvs);
+
+    return failed > MAX_FAIL_CODE ? MAX_FAIL_CODE : (int)failed;
+}
@@ -0,0 +1,239 @@
+#include "common.h"
+#include "path_cache.h"
+#include "variables.h"
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_INITIAL_CAP 64
+#define DEFAULT_PATH      "/usr/local/bin:/usr/bin:/bin"
+
+typedef struct {
+    char     *name;   // NULL marks a free slot
+    char     *path;   // NULL until (re)resolved
+    uint64_t hash;
+    size_t   hits;
+} CacheEntry;
+
+typedef struct {
+    CacheEntry *entries;
+    size_t     cap;     // power of two
+    size_t     count;
+    uint64_t   path_gen;   // VarsPathGeneration() the entries were resolved under
+    char       *relative;  // last hit in a relative $PATH element, never cached
+} PathCache;
+
+static PathCache cache = {NULL, 0, 0, 0, NULL};
+
+static uint64_t    hashName   (const char *name);
+static CacheEntry* findSlot   (const char *name, uint64_t hash);
+static CmdError    growCache  ();
+static char*       resolvePath(const char *name, const char *path_env, int *relative);
+static const char* syncPathEnv();
+
+static uint64_t hashName(const char *name) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a
+    for (const unsigned char *p = (const unsigned char*)name; *p != '\0'; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static CacheEntry* findSlot(const char *name, uint64_t hash) {
+    size_t mask = cache.cap - 1;
+    for (size_t i = (size_t)hash & mask; ; i = (i + 1) & mask) {
+        CacheEntry *e = &cache.entries[i];
+        if (e->name == NULL || (e->hash == hash && strcmp(e->name, name) == 0)) {
+            return e;
+        }
+    }
+}
+
+static CmdError growCache() {
+    size_t     new_cap = cache.cap == 0 ? CACHE_INITIAL_CAP : cache.cap * 2;
+    CacheEntry *old    = cache.entries;
+    size_t     old_cap = cache.cap;
+
+    cache.entries = (CacheEntry*)calloc(new_cap, sizeof(CacheEntry));
+    if (cache.entries == NULL) {
+        cache.entries = old;
+        return ALLOC_ERR;
+    }
+    cache.cap = new_cap;
+
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].name != NULL) {
+            *findSlot(old[i].name, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+    return OK;
+}
+
+// *relative is set when the hit is in '.', an empty element or any other relative directory:
+// that path means something else after the next cd, so it must not be remembered
+static char* resolvePath(const char *name, const char *path_env, int *relative) {
+    size_t name_len = strlen(name);
+    const char *dir = path_env;
+
+    while (1) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len  = end ? (size_t)(end - dir) : strlen(dir);
+
+        // An empty $PATH element means the current directory
+        char *full = (char*)malloc(dir_len + name_len + 3);
+        if (full == NULL) {
+            return NULL;
+        }
+        if (dir_len == 0) {
+            memcpy(full, ".", 1);
+            dir_len = 1;
+        }
+        else {
+            memcpy(full, dir, dir_len);
+        }
+        full[dir_len] = '/';
+        memcpy(full + dir_len + 1, name, name_len + 1);
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) {
+            *relative = full[0] != '/';
+            return full;
+        }
+        free(full);
+
+        if (end == NULL) {
+            return NULL;
+        }
+        dir = end + 1;
+    }
+}
+
+// The variables table counts changes to $PATH, so an unchanged one costs no string compare
+static const char* syncPathEnv() {
+    uint64_t gen = VarsPathGeneration();
+    if (cache.path_gen != gen) {
+        PathCacheClear();
+        cache.path_gen = gen;
+    }
+
+    const char *path_env = VarGet("PATH");
+    return path_env != NULL ? path_env : DEFAULT_PATH;
+}
+
+const char* PathCacheLookup(const char *name) {
+    assert(name);
+
+    if (strchr(name, '/') != NULL) {
+        return name;  // explicit paths are never searched
+    }
+
+    const char *path_env = syncPathEnv();
+
+    if ((cache.count + 1) * 2 > cache.cap && growCache() != OK) {
+        return NULL;
+    }
+
+    uint64_t   hash     = hashName(name);
+    CacheEntry *e       = findSlot(name, hash);
+    int        relative = 0;
+
+    if (e->name == NULL || e->path == NULL) {
+        free(cache.relative);
+        cache.relative = NULL;
+    }
+
+    if (e->name == NULL) {
+        char *path = resolvePath(name, path_env, &relative);
+        if (path == NULL) {
+            return NULL;  // misses are not cached: the command may be installed later
+        }
+        if (relative) {
+            return cache.relative = path;
+        }
+        e->name = strdup(name);
+        if (e->name == NULL) {
+            free(path);
+            return NULL;
+        }
+        e->path = path;
+        e->hash = hash;
+        e->hits = 0;
+        cache.count++;
+    }
+    else if (e->path == NULL) {
+        char *path = resolvePath(name, path_env, &relative);
+        if (path == NULL || relative) {
+            return cache.relative = path;
+        }
+        e->path = path;
+    }
+
+    e->hits++;
+    return e->path;
+}
+
+// Keeps the slot but makes the next lookup search $PATH again (e.g. the binary moved).
+void PathCacheForget(const char *name) {
+    assert(name);
+
+    if (cache.cap == 0) {
+        return;
+    }
+
+    CacheEntry *e = findSlot(name, hashName(name));
+    if (e->name != NULL) {
+        free(e->path);
+        e->path = NULL;
+    }
+}
+
+void PathCacheClear() {
+    for (size_t i = 0; i < cache.cap; i++) {
+        free(cache.entries[i].name);
+        free(cache.entries[i].path);
+    }
+    free(cache.entries);
+    free(cache.relative);
+
+    cache.entries  = NULL;
+    cache.cap      = 0;
+    cache.count    = 0;
+    cache.relative = NULL;
+}
+
+// hash        list remembered commands
+// hash -r     forget everything
+// hash NAME.. look NAMEs up now
+int HashBuiltin(Command *cmd) {
+    assert(cmd);
+
+    if (cmd->argc == 1) {
+        if (cache.count == 0) {
+            printf("hash: hash table empty\n");
+            return 0;
+        }
+        printf("hits\tcommand\n");
+        for (size_t i = 0; i < cache.cap; i++) {
+            CacheEntry *e = &cache.entries[i];
+            if (e->name != NULL && e->path != NULL) {
+                printf("%4zu\t%s\n", e->hits, e->path);
+            }
+        }
+        return 0;
+    }
+
+    int rc = 0;
+    for (size_t i = 1; i < cmd->argc; i++) {
+        if (strcmp(cmd->argv[i], "-r") == 0) {
+            PathCacheClear();
+        }
+        else if (PathCacheLookup(cmd->argv[i]) == NULL) {
+            fprintf(stderr, "shell: hash: %s: not found\n", cmd->argv[i]);
+            rc = 1;
+        }
+    }
+    return rc;
+}
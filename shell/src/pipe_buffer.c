@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+
+#include "pipe_buffer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define PIPE_MAX_SIZE_FILE    "/proc/sys/fs/pipe-max-size"
+#define PIPE_MAX_SIZE_DEFAULT (1024 * 1024)
+
+typedef struct {
+    int    rd;
+    int    wr;
+    size_t fill;   // bytes currently held
+    int    full;   // the last splice into it would have blocked
+} Segment;
+
+static size_t   pipeMaxSize();
+static CmdError openSegments(Segment *segs, size_t count, size_t size);
+static void     closeSegments(Segment *segs, size_t count);
+
+CmdError SetPipeSize(int fd, size_t size) {
+    if (size > (size_t)0x7fffffff || fcntl(fd, F_SETPIPE_SZ, (int)size) < 0) {
+        return SYNTAX_ERR;
+    }
+    return OK;
+}
+
+static size_t pipeMaxSize() {
+    size_t size = PIPE_MAX_SIZE_DEFAULT;
+
+    FILE *f = fopen(PIPE_MAX_SIZE_FILE, "re");
+    if (f != NULL) {
+        unsigned long val = 0;
+        if (fscanf(f, "%lu", &val) == 1 && val > 0) {
+            size = (size_t)val;
+        }
+        fclose(f);
+    }
+    return size;
+}
+
+static CmdError openSegments(Segment *segs, size_t count, size_t size) {
+    for (size_t i = 0; i < count; i++) {
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+            closeSegments(segs, i);
+            return ALLOC_ERR;
+        }
+        SetPipeSize(fds[1], size);  // best effort: a smaller pipe only means less buffering
+
+        segs[i].rd   = fds[0];
+        segs[i].wr   = fds[1];
+        segs[i].fill = 0;
+        segs[i].full = 0;
+    }
+    return OK;
+}
+
+static void closeSegments(Segment *segs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        close(segs[i].rd);
+        close(segs[i].wr);
+    }
+}
+
+// Segments head..tail hold data in order: the producer fills tail, the consumer drains head.
+// in_fd/out_fd are shared with the neighbouring stages, so they stay blocking and only the
+// splice calls themselves are non-blocking.
+int PumpPipeBuffer(int in_fd, int out_fd, size_t capacity) {
+    size_t seg_size = pipeMaxSize();
+    if (seg_size > capacity) {
+        seg_size = capacity;
+    }
+    size_t count = (capacity + seg_size - 1) / seg_size;
+    if (count == 0) {
+        count = 1;
+    }
+
+    Segment *segs = (Segment*)calloc(count, sizeof(Segment));
+    if (segs == NULL || openSegments(segs, count, seg_size) != OK) {
+        free(segs);
+        fprintf(stderr, "shell: |>: cannot allocate buffer\n");
+        return 1;
+    }
+
+    size_t head     = 0;
+    size_t tail     = 0;
+    size_t buffered = 0;
+    int    in_open  = 1;
+    int    rc       = 0;
+
+    while (in_open || buffered > 0) {
+        size_t next_tail = (tail + 1) % count;
+        if (segs[tail].full && next_tail != head && segs[next_tail].fill == 0) {
+            tail = next_tail;
+        }
+
+        struct pollfd pfd[2];
+        nfds_t        n      = 0;
+        int           in_idx = -1, out_idx = -1;
+
+        if (in_open && !segs[tail].full) {
+            pfd[n].fd = in_fd;  pfd[n].events = POLLIN;  in_idx  = (int)n++;
+        }
+        if (buffered > 0) {
+            pfd[n].fd = out_fd; pfd[n].events = POLLOUT; out_idx = (int)n++;
+        }
+
+        assert(n > 0);  // a segment is only full while it holds data, so there is output to wait for
+
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            rc = 1;
+            break;
+        }
+
+        if (in_idx != -1 && pfd[in_idx].revents != 0) {
+            Segment *seg = &segs[tail];
+            ssize_t  got = splice(in_fd, NULL, seg->wr, NULL, seg_size,
+                                  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (got > 0) {
+                seg->fill += (size_t)got;
+                buffered  += (size_t)got;
+            }
+            else if (got == 0) {
+                in_open = 0;
+            }
+            else if (errno == EAGAIN) {
+                // With data already in it, it is our segment that is full; into an empty
+                // one it was a spurious wakeup (someone else read the input), so poll again
+                if (seg->fill > 0) {
+                    seg->full = 1;
+                }
+            }
+            else {
+                in_open = 0;
+                rc      = 1;
+            }
+        }
+
+        if (out_idx != -1 && pfd[out_idx].revents != 0) {
+            if (pfd[out_idx].revents & (POLLERR | POLLHUP)) {
+                break;  // consumer went away
+            }
+
+            Segment *seg  = &segs[head];
+            ssize_t  sent = splice(seg->rd, NULL, out_fd, NULL, seg->fill,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (sent > 0) {
+                seg->fill -= (size_t)sent;
+                buffered  -= (size_t)sent;
+                if (seg->fill == 0) {
+                    seg->full = 0;
+                    if (head != tail) {
+                        head = (head + 1) % count;
+                    }
+                }
+            }
+            else if (sent < 0 && errno != EAGAIN) {
+                rc = errno == EPIPE ? 0 : 1;
+                break;
+            }
+        }
+    }
+
+    closeSegments(segs, count);
+    free(segs);
+    return rc;
+}
@@ -0,0 +1,101 @@
+#include "common.h"
+#include "plan_cache.h"
+
+#include <stdint.h>
+
+#define PLAN_ARENA_BLOCK 256
+
+typedef struct {
+    uint64_t    hash;
+    char        *text;   // NULL while the slot holds no valid plan
+    size_t      len;
+    CommandLine *plan;   // kept across evictions, its buffers are reused
+} PlanSlot;
+
+typedef struct {
+    PlanSlot *slots;
+    size_t   cap;        // power of two
+} PlanCache;
+
+static PlanCache cache = {NULL, 0};
+
+static uint64_t hashLine(const char *line, size_t len);
+
+static uint64_t hashLine(const char *line, size_t len) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)line[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+CmdError PlanCacheInit(size_t capacity) {
+    size_t cap = 1;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+
+    cache.slots = (PlanSlot*)calloc(cap, sizeof(PlanSlot));
+    if (cache.slots == NULL) {
+        return ALLOC_ERR;
+    }
+    cache.cap = cap;
+    return OK;
+}
+
+// On a miss the line is parsed straight into the slot's CommandLine, evicting what was there.
+// The returned plan stays valid until the next call.
+CmdError PlanCacheGet(const char *line, size_t len, CommandLine **plan) {
+    assert(line);
+    assert(plan);
+    assert(cache.slots);
+
+    uint64_t hash = hashLine(line, len);
+    PlanSlot *slot = &cache.slots[hash & (cache.cap - 1)];
+
+    if (slot->text != NULL && slot->hash == hash && slot->len == len &&
+        memcmp(slot->text, line, len) == 0) {
+        *plan = slot->plan;
+        return OK;
+    }
+
+    free(slot->text);
+    slot->text = NULL;
+
+    if (slot->plan == NULL) {
+        slot->plan = InitCommandLineSized(PLAN_ARENA_BLOCK);
+        if (slot->plan == NULL) {
+            return ALLOC_ERR;
+        }
+    }
+
+    CmdError err = ParseCommandLine(line, slot->plan);
+    if (err != OK) {
+        return err;
+    }
+
+    // Glob results depend on the directory contents at parse time
+    *plan = slot->plan;
+    if (slot->plan->dynamic) {
+        return OK;
+    }
+
+    slot->text = (char*)malloc(len + 1);
+    if (slot->text != NULL) {
+        memcpy(slot->text, line, len + 1);
+        slot->hash = hash;
+        slot->len  = len;
+    }
+    return OK;
+}
+
+void PlanCacheFree() {
+    for (size_t i = 0; i < cache.cap; i++) {
+        free(cache.slots[i].text);
+        FreeCommandLine(cache.slots[i].plan);
+    }
+    free(cache.slots);
+    cache.slots = NULL;
+    cache.cap   = 0;
+}
@@ -1,25 +1,551 @@
 #include <stdio.h>
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <termios.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "command_parser.h"
+#include "completion.h"
+#include "history.h"
+#include "jobs.h"
+#include "variables.h"
 
-#define CMD_BUFFER 1024
+#define READ_CHUNK   (64 * 1024)
+#define BATCH_CHUNK  (1024 * 1024)  // scripts are read in big blocks, nobody waits for a prompt
+#define PROMPT       COLOR_GREEN "shell> " COLOR_RESET
+#define MORE_PROMPT  "> "   // heredoc body lines
+#define SEARCH_MAX   256
+#define COMPLETE_MAX 256   // longest completion inserted at once
 
-char* ReadCmd() 
+#define KEY_CTRL_C    0x03
+#define KEY_CTRL_D    0x04
+#define KEY_CTRL_G    0x07
+#define KEY_BACKSPACE 0x08
+#define KEY_TAB       0x09
+#define KEY_CTRL_R    0x12
+#define KEY_ESC       0x1b
+#define KEY_DELETE    0x7f
+
+// Our own buffer over the input fd instead of stdio: we must know whether a line is already
+// buffered before blocking in the event loop, which a FILE* does not tell.
+typedef struct {
+    char   *data;
+    size_t start;
+    size_t end;
+    size_t cap;
+    int    eof;
+    int    fd;
+    int    interactive;
+    int    editing;     // a terminal: keys are handled one by one, see editLine()
+    size_t chunk;
+    const char *prompt;
+} InputBuffer;
+
+// The line being edited lives in the caller's buffer
+typedef struct {
+    char   **buf;
+    size_t *cap;
+    size_t len;
+} EditState;
+
+static InputBuffer input = {NULL, 0, 0, 0, 0, STDIN_FILENO, 1, 0, READ_CHUNK, PROMPT};
+
+static void     printPrompt();
+static CmdError fillInput();
+static ssize_t  takeLine(char **buf, size_t *cap, size_t len);
+static int      nextKey(EditState *line, char *key);
+static int      putKey(EditState *line, char key);
+static void     redraw(const EditState *line);
+static void     completeWord(EditState *line, int repeated);
+static int      reverseSearch(EditState *line);
+static ssize_t  editLine(char **buf, size_t *cap);
+static CmdError readBody(Arena *arena, Redirect *redir, char **line, size_t *line_cap);
+
+void ReadCmdInit(int fd, int interactive)
+{
+    input.fd          = fd;
+    input.interactive = interactive;
+    input.editing     = interactive && isatty(fd);
+    input.chunk       = interactive ? READ_CHUNK : BATCH_CHUNK;
+
+    if (input.editing && CompletionInit() != OK)
+    {
+        fprintf(stderr, "shell: command completion is not available\n");
+    }
+}
+
+// For -c: the whole text is the input, no fd is read at all
+CmdError ReadCmdInitString(const char *text)
+{
+    assert(text);
+
+    size_t len  = strlen(text);
+    char  *data = (char*)malloc(len + 1);
+    if (data == NULL)
+    {
+        return ALLOC_ERR;
+    }
+    memcpy(data, text, len + 1);
+
+    free(input.data);
+    input.data        = data;
+    input.start       = 0;
+    input.end         = len;
+    input.cap         = len + 1;
+    input.eof         = 1;
+    input.fd          = -1;
+    input.interactive = 0;
+    input.editing     = 0;
+    return OK;
+}
+
+void ReadCmdFree()
+{
+    if (input.editing)
+    {
+        CompletionFree();
+    }
+    free(input.data);
+    input.data  = NULL;
+    input.start = 0;
+    input.end   = 0;
+    input.cap   = 0;
+}
+
+static void printPrompt()
+{
+    if (!input.interactive)
+    {
+        return;
+    }
+    printf("%s", input.prompt);
+    fflush(stdout);
+}
+
+static CmdError fillInput()
+{
+    if (input.start > 0)
+    {
+        memmove(input.data, input.data + input.start, input.end - input.start);
+        input.end  -= input.start;
+        input.start = 0;
+    }
+
+    if (input.cap - input.end < input.chunk)
+    {
+        size_t new_cap = input.cap == 0 ? 2 * input.chunk : input.cap * 2;
+        char  *data    = (char*)realloc(input.data, new_cap);
+        if (data == NULL)
+        {
+            input.eof = 1;  // nothing more can be read: hand back what is buffered and stop
+            return ALLOC_ERR;
+        }
+        input.data = data;
+        input.cap  = new_cap;
+    }
+
+    ssize_t n = read(input.fd, input.data + input.end, input.cap - input.end);
+    if (n == 0)
+    {
+        input.eof = 1;
+    }
+    else if (n < 0)
+    {
+        if (errno == EINTR)
+        {
+            return OK;
+        }
+        input.eof = 1;
+        return READ_ERR;
+    }
+    else
+    {
+        input.end += (size_t)n;
+    }
+    return OK;
+}
+
+static ssize_t takeLine(char **buf, size_t *cap, size_t len)
+{
+    if (*cap < len + 1)
+    {
+        char *grown = (char*)realloc(*buf, len + 1);
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        *buf = grown;
+        *cap = len + 1;
+    }
+
+    memcpy(*buf, input.data + input.start, len);
+    (*buf)[len]  = '\0';
+    input.start += len;
+    return (ssize_t)len;
+}
+
+// Next byte of terminal input; finished background jobs are reported while waiting.
+// Returns 0 at end of input.
+static int nextKey(EditState *line, char *key)
+{
+    while (input.start == input.end)
+    {
+        if (input.eof)
+        {
+            return 0;
+        }
+        if (JobsWaitInput(input.fd))
+        {
+            printf("\n");
+            JobsNotify();
+            redraw(line);
+            continue;
+        }
+        if (fillInput() != OK)
+        {
+            return 0;
+        }
+    }
+
+    *key = input.data[input.start++];
+    return 1;
+}
+
+static int putKey(EditState *line, char key)
+{
+    if (line->len + 2 > *line->cap)
+    {
+        size_t new_cap = *line->cap < 64 ? 128 : *line->cap * 2;
+        char  *grown   = (char*)realloc(*line->buf, new_cap);
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        *line->buf = grown;
+        *line->cap = new_cap;
+    }
+    (*line->buf)[line->len++] = key;
+    (*line->buf)[line->len]   = '\0';
+    return 0;
+}
+
+static void redraw(const EditState *line)
 {
-    char *string_cmd = (char*)calloc(CMD_BUFFER, sizeof(char));
-    if (string_cmd == NULL) 
+    printf("\r\x1b[K%s%.*s", input.prompt, (int)line->len, line->len > 0 ? *line->buf : "");
+    fflush(stdout);
+}
+
+// Completes the word under the cursor when it is in command position: first on the line
+// or right after a '|'. A second Tab on an ambiguous prefix lists the candidates.
+static void completeWord(EditState *line, int repeated)
+{
+    const char *text  = line->len > 0 ? *line->buf : "";
+    size_t      start = line->len;
+    while (start > 0 && strchr(" \t|<>", text[start - 1]) == NULL)
     {
-        return NULL;
+        start--;
     }
 
-    printf(COLOR_GREEN "shell> " COLOR_RESET);
-    if (fgets(string_cmd, CMD_BUFFER, stdin) == NULL) 
+    size_t before = start;
+    while (before > 0 && (text[before - 1] == ' ' || text[before - 1] == '\t'))
+    {
+        before--;
+    }
+    if ((before > 0 && text[before - 1] != '|') || memchr(text + start, '/', line->len - start) != NULL)
+    {
+        return;   // an argument or a path, not a command name
+    }
+
+    char   ext[COMPLETE_MAX];
+    size_t matches = 0;
+    size_t n = CompletionExtend(text + start, line->len - start, ext, sizeof(ext), &matches);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        putKey(line, ext[i]);
+    }
+    if (matches == 1)
+    {
+        putKey(line, ' ');
+    }
+    else if (n == 0 && matches > 1 && repeated)
+    {
+        printf("\n");
+        CompletionList(*line->buf + start, line->len - start, stdout);
+    }
+    redraw(line);
+}
+
+// Ctrl-R: each key refines the needle, another Ctrl-R steps to an older match.
+// Returns 1 if Enter accepted the match as the line to run, 0 to keep editing it.
+static int reverseSearch(EditState *line)
+{
+    char        needle[SEARCH_MAX] = "";
+    size_t      needle_len = 0;
+    size_t      before     = SIZE_MAX;
+    size_t      match_len  = 0;
+    size_t      match_pos  = SIZE_MAX;
+    const char *match      = NULL;
+
+    while (1)
+    {
+        printf("\r\x1b[K(reverse-i-search)`%s': %.*s", needle, (int)match_len, match != NULL ? match : "");
+        fflush(stdout);
+
+        char key = 0;
+        if (!nextKey(line, &key) || key == KEY_CTRL_G || key == KEY_CTRL_C)
+        {
+            redraw(line);
+            return 0;
+        }
+
+        if (key == KEY_CTRL_R)
+        {
+            before = match_pos;   // older than the current match
+        }
+        else if (key == KEY_DELETE || key == KEY_BACKSPACE)
+        {
+            needle_len -= needle_len > 0 ? 1 : 0;
+            needle[needle_len] = '\0';
+            before = SIZE_MAX;
+        }
+        else if ((unsigned char)key >= ' ' && needle_len + 1 < sizeof(needle))
+        {
+            needle[needle_len++] = key;
+            needle[needle_len]   = '\0';
+            before = SIZE_MAX;
+        }
+        else
+        {
+            // Enter runs the match, any other control key leaves it on the line to edit
+            line->len = 0;
+            for (size_t i = 0; match != NULL && i < match_len; i++)
+            {
+                putKey(line, match[i]);
+            }
+            redraw(line);
+            return key == '\r' || key == '\n';
+        }
+
+        size_t      len = 0;
+        size_t      pos = 0;
+        const char *found = needle_len > 0 ? HistoryFind(needle, before, &len, &pos) : NULL;
+        if (found != NULL || key != KEY_CTRL_R)
+        {
+            match     = found;
+            match_len = found != NULL ? len : 0;
+            match_pos = found != NULL ? pos : SIZE_MAX;
+        }
+    }
+}
+
+// A small line editor for terminals: typing, Backspace, Tab completion of command names,
+// Ctrl-R history search, Ctrl-C to drop the line, Ctrl-D on an empty line for end of input.
+static ssize_t editLine(char **buf, size_t *cap)
+{
+    struct termios saved;
+    struct termios raw;
+    tcgetattr(input.fd, &saved);
+    raw = saved;
+    raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO | ISIG);
+    raw.c_cc[VMIN]  = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(input.fd, TCSANOW, &raw);
+
+    EditState line = {buf, cap, 0};
+    ssize_t   result = -1;
+    char      prev   = 0;
+    char      key    = 0;
+
+    if (*cap > 0)
+    {
+        (*buf)[0] = '\0';
+    }
+
+    while (nextKey(&line, &key))
+    {
+        if (key == '\r' || key == '\n' ||
+            (key == KEY_CTRL_R && reverseSearch(&line)))
+        {
+            printf("\n");
+            putKey(&line, '\n');
+            result = (ssize_t)line.len;
+            break;
+        }
+        if (key == KEY_CTRL_D && line.len == 0)
+        {
+            printf("\n");
+            break;
+        }
+
+        switch (key)
+        {
+            case KEY_TAB:
+                completeWord(&line, prev == KEY_TAB);
+                break;
+            case KEY_DELETE:
+            case KEY_BACKSPACE:
+                if (line.len > 0)
+                {
+                    (*buf)[--line.len] = '\0';
+                    printf("\b \b");
+                }
+                break;
+            case KEY_CTRL_C:
+                printf("^C\n");
+                line.len = 0;
+                redraw(&line);
+                break;
+            case KEY_ESC:
+                // Arrow and function keys are not supported: drop "ESC [ x" sequences
+                if (nextKey(&line, &key) && key == '[')
+                {
+                    while (nextKey(&line, &key) && !((key >= 'A' && key <= 'Z') || (key >= 'a' && key <= 'z') || key == '~'))
+                    {
+                    }
+                }
+                break;
+            case KEY_CTRL_R:
+                break;   // search ended with the match left on the line
+            default:
+                if ((unsigned char)key >= ' ' && putKey(&line, key) == 0)
+                {
+                    putchar(key);
+                }
+                break;
+        }
+        fflush(stdout);
+        prev = key;
+    }
+
+    fflush(stdout);
+    tcsetattr(input.fd, TCSANOW, &saved);
+    return result;
+}
+
+// Reads one line of any length into *buf, growing it as needed, getline()-style.
+// The caller keeps buf/cap between calls so the buffer is reused, and frees it at the end.
+// While waiting for interactive input, finished background jobs are reported.
+ssize_t ReadCmd(char **buf, size_t *cap) 
+{
+    assert(buf);
+    assert(cap);
+
+    printPrompt();
+    if (input.editing)
+    {
+        return editLine(buf, cap);
+    }
+
+    while (1)
+    {
+        size_t avail = input.end - input.start;
+        char  *nl    = avail ? (char*)memchr(input.data + input.start, '\n', avail) : NULL;
+
+        if (nl != NULL)
+        {
+            return takeLine(buf, cap, (size_t)(nl - (input.data + input.start)) + 1);
+        }
+        if (input.eof)
+        {
+            return avail > 0 ? takeLine(buf, cap, avail) : -1;
+        }
+
+        if (input.interactive && JobsWaitInput(input.fd))
+        {
+            printf("\n");
+            JobsNotify();
+            printPrompt();
+            continue;
+        }
+
+        if (fillInput() != OK)
+        {
+            fprintf(stderr, "Error reading string_cmd\n");
+        }
+    }
+}
+
+// Lines up to the one that is exactly the delimiter become the body, in the line's arena.
+// Running out of input ends the body early, as in sh.
+static CmdError readBody(Arena *arena, Redirect *redir, char **line, size_t *line_cap)
+{
+    const char *delim     = redir->target;
+    size_t      delim_len = strlen(delim);
+    char       *body      = NULL;
+    size_t      len       = 0;
+    size_t      cap       = 0;
+    ssize_t     n         = 0;
+    CmdError    err       = OK;
+
+    while ((n = ReadCmd(line, line_cap)) >= 0)
+    {
+        size_t text = (size_t)n - (n > 0 && (*line)[n - 1] == '\n');
+        if (text == delim_len && memcmp(*line, delim, delim_len) == 0)
+        {
+            break;
+        }
+
+        if (len + (size_t)n + 1 > cap)
+        {
+            size_t new_cap = cap == 0 ? 256 : cap * 2;
+            while (new_cap < len + (size_t)n + 1)
+            {
+                new_cap *= 2;
+            }
+            char *grown = (char*)realloc(body, new_cap);
+            if (grown == NULL)
+            {
+                free(body);
+                return ALLOC_ERR;
+            }
+            body = grown;
+            cap  = new_cap;
+        }
+        memcpy(body + len, *line, (size_t)n);
+        len += (size_t)n;
+    }
+    if (n < 0)
+    {
+        fprintf(stderr, "shell: here-document ended by end of input (wanted '%s')\n", delim);
+    }
+
+    char *copy = ArenaStrndup(arena, len > 0 ? body : "", len);
+    free(body);
+    if (copy == NULL)
+    {
+        return ALLOC_ERR;
+    }
+    redir->target = copy;
+    if (redir->expand)
+    {
+        err = VarsExpand(arena, copy, &redir->target);
+    }
+    return err;
+}
+
+// Reads the bodies of the line's '<<' redirections from the input that follows it, in order.
+CmdError ReadCmdHeredocs(CommandLine *cline)
+{
+    assert(cline);
+
+    char    *line     = NULL;
+    size_t   line_cap = 0;
+    CmdError err      = OK;
+
+    input.prompt = MORE_PROMPT;
+    for (size_t i = 0; i < cline->redir_total && cline->heredocs > 0 && err == OK; i++)
     {
-        fprintf(stderr, "Error reading string_cmd\n");
-        return NULL;
+        if (cline->redirs[i].kind == REDIR_HEREDOC)
+        {
+            err = readBody(&cline->arena, &cline->redirs[i], &line, &line_cap);
+            cline->heredocs--;
+        }
     }
+    input.prompt = PROMPT;
 
-    return string_cmd;
+    free(line);
+    return err;
 }
@@ -1,60 +1,235 @@
+#include "builtins.h"
 #include "common.h"
+#include "jobs.h"
+#include "path_cache.h"
+#include "pipe_buffer.h"
 #include "run_cmd.h"
+#include "variables.h"
 
+#include <errno.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
-void RunCmd(CommandLine *cline) {
+static pid_t startStage(Command *cmd, const StageIo *io, const RunOptions *opts);
+static pid_t launchStage(Command *cmd, const StageIo *io, const RunOptions *opts);
+static int   runBuiltinHere(const Builtin *builtin, Command *cmd, int timed, const RunOptions *opts);
+static void  reportTiming(const StageTiming *stages, size_t count, const RunOptions *opts);
+static int   openPipe(int fds[2], const RunOptions *opts);
+
+static int openPipe(int fds[2], const RunOptions *opts) {
+    static int size_warned = 0;
+
+    if (pipe(fds) < 0) {
+        fprintf(stderr, "failed to create pipe\n");
+        return -1;
+    }
+    if (opts->pipe_size != 0 && SetPipeSize(fds[1], opts->pipe_size) != OK && !size_warned) {
+        fprintf(stderr, "shell: cannot set pipe size to %zu, keeping the default\n", opts->pipe_size);
+        size_warned = 1;
+    }
+    return 0;
+}
+
+static void reportTiming(const StageTiming *stages, size_t count, const RunOptions *opts) {
+    PrintTiming(stderr, stages, count);
+    if (opts->timing_log != NULL) {
+        PrintTimingRecord(opts->timing_log, stages, count);
+    }
+}
+
+static int runBuiltinHere(const Builtin *builtin, Command *cmd, int timed, const RunOptions *opts) {
+    StageTiming   t = {.name = cmd->argv[0], .pid = -1};
+    struct rusage before;
+
+    if (timed) {
+        getrusage(RUSAGE_SELF, &before);
+        TimingNow(&t.start);
+    }
+
+    // Like in sh, assignments before a builtin run by the shell itself stay set
+    VarsApply(cmd->assigns, cmd->assign_count, VAR_KEEP_EXPORT);
+
+    SavedFd *saved  = NULL;
+    size_t   nsaved = 0;
+    if (OpenHereDocs(cmd) != OK) {
+        return 1;
+    }
+    if (RedirectShell(cmd, &saved, &nsaved) != OK) {
+        CloseHereDocs(cmd);
+        return 1;
+    }
+
+    int rc = builtin->fn(cmd);
+    fflush(stdout);
+    RestoreShell(saved, nsaved);
+    CloseHereDocs(cmd);
+
+    if (timed) {
+        TimingNow(&t.end);
+        TimingSelfDelta(&before, &t.usage);
+        t.status = rc;
+        reportTiming(&t, 1, opts);
+    }
+    return rc;
+}
+
+// Heredoc bodies are open only while the stage starts; the child keeps its own copies
+static pid_t startStage(Command *cmd, const StageIo *io, const RunOptions *opts) {
+    if (OpenHereDocs(cmd) != OK) {
+        return -1;
+    }
+    pid_t pid = launchStage(cmd, io, opts);
+    CloseHereDocs(cmd);
+    return pid;
+}
+
+static pid_t launchStage(Command *cmd, const StageIo *io, const RunOptions *opts) {
+    const char    *name    = cmd->argv[0];
+    const Builtin *builtin = FindBuiltin(name);
+
+    if (builtin != NULL) {
+        return LaunchBuiltin(builtin, cmd, io);
+    }
+
+    const char *path = PathCacheLookup(name);
+    if (path == NULL) {
+        fprintf(stderr, "shell: %s: command not found\n", name);
+        return -1;
+    }
+
+    // Without assignments every launch shares one envp snapshot, no copy is made
+    char **envp = cmd->assign_count > 0 ? VarsEnvironWith(cmd->assigns, cmd->assign_count)
+                                        : VarsEnviron();
+    if (envp == NULL) {
+        fprintf(stderr, "failed to allocate environment\n");
+        return -1;
+    }
+
+    pid_t pid = LaunchStage(opts->launcher, path, cmd, envp, io);
+    int   err = errno;
+    if (cmd->assign_count > 0) {
+        free(envp);
+    }
+    if (pid == -1 && err == ENOENT) {
+        PathCacheForget(name);  // the cached binary is gone, search again next time
+    }
+    return pid;
+}
+
+// Returns the exit status of the last stage, as $? would report it.
+int RunCmd(CommandLine *cline, const RunOptions *opts) {
     assert(cline);
+    assert(opts);
 
-    int   pipeFd[2]       = {-1, -1};
-    pid_t pid             = -1;
-    int   prev_pipe_read  = -1;
+    if (cline->cmd_count == 0) {
+        return 0;
+    }
+
+    // A lone builtin runs right here: that is what lets cd and exit change the shell itself
+    int timed = (opts->timing || cline->timed) && !cline->background;
 
-    for (size_t i = 0; i < cline->cmd_count; i++) {
-        if (pipe(pipeFd) < 0) {
-            exit(1);
+    if (cline->cmd_count == 1 && !cline->background) {
+        const Builtin *builtin = FindBuiltin(cline->cmds[0].argv[0]);
+        if (builtin != NULL) {
+            return runBuiltinHere(builtin, &cline->cmds[0], timed, opts);
         }
+    }
 
-        pid = fork();
+    Job *job = StartPipeline(cline, opts, -1);
+    if (job == NULL) {
+        return 1;
+    }
+
+    if (cline->background) {
+        JobDetach(job);
+        return 0;
+    }
+
+    int status = JobWait(job);
+    if (timed) {
+        size_t             count  = 0;
+        const StageTiming *stages = JobStages(job, &count);
+        reportTiming(stages, count, opts);
+    }
+    JobRelease(job);
+    return status;
+}
+
+// Starts every stage of the line and returns without waiting. The last stage writes
+// to out_fd, or to the shell's stdout if it is -1.
+Job* StartPipeline(CommandLine *cline, const RunOptions *opts, int out_fd) {
+    assert(cline);
+    assert(opts);
+    assert(cline->cmd_count > 0);
 
-        if (pid == -1) {
-            fprintf(stderr, "failed to create process\n");
-            return;
+    Job *job = JobCreate(cline);
+    if (job == NULL) {
+        fprintf(stderr, "failed to allocate job\n");
+        return NULL;
+    }
+
+    int    pipeFd[2]       = {-1, -1};
+    pid_t  pid             = -1;
+    int    prev_pipe_read  = -1;
+    size_t stage           = 0;
+
+    for (size_t i = 0; i < cline->cmd_count; i++, stage++) {
+        int is_last = (i == cline->cmd_count - 1);
+
+        pipeFd[0] = -1;
+        pipeFd[1] = is_last ? out_fd : -1;
+        if (!is_last && openPipe(pipeFd, opts) < 0) {
+            break;
         }
-        else if (pid == 0) {
-            if (prev_pipe_read != -1) {
-                dup2(prev_pipe_read, STDIN_FILENO);  // Redirect stdin to read from previous pipe
-                close(prev_pipe_read);
-            }
 
-            if (i < cline->cmd_count - 1) {
-                dup2(pipeFd[1], STDOUT_FILENO);   // Redirect stdout to write to current pipe
-                close(pipeFd[0]);                    
-                close(pipeFd[1]);                   
-            }
+        StageIo io = {
+            .in_fd    = prev_pipe_read,
+            .out_fd   = pipeFd[1],
+            .close_fd = pipeFd[0],
+        };
+
+        JobStageStarting(job, stage);
+        pid = startStage(&cline->cmds[i], &io, opts);
+        if (pid != -1) {
+            JobAddPid(job, stage, pid);
+        }
+
+        if (prev_pipe_read != -1) {
+            close(prev_pipe_read);
+        }
 
-            execvp(cline->cmds[i].argv[0], cline->cmds[i].argv);
-            exit(1);
+        if (!is_last) {
+            close(pipeFd[1]);
+            prev_pipe_read = pipeFd[0];
         }
-        else {
-            if (prev_pipe_read != -1) {
-                close(prev_pipe_read);
+
+        // '|>': a splice-only stage sits between this command and the next one
+        if (cline->cmds[i].buffer_out) {
+            stage++;
+            if (openPipe(pipeFd, opts) < 0) {
+                break;
             }
 
-             if (i < cline->cmd_count - 1) {
-                close(pipeFd[1]);           
-                prev_pipe_read = pipeFd[0]; 
+            StageIo buf_io = {
+                .in_fd    = prev_pipe_read,
+                .out_fd   = pipeFd[1],
+                .close_fd = pipeFd[0],
+            };
+
+            JobStageStarting(job, stage);
+            pid_t buf_pid = LaunchPipeBuffer(opts->buffer_size, &buf_io);
+            if (buf_pid != -1) {
+                JobAddPid(job, stage, buf_pid);
             }
+
+            close(prev_pipe_read);
+            close(pipeFd[1]);
+            prev_pipe_read = pipeFd[0];
         }
     }
 
-    int status = 0;
-    for (size_t i = 0; i < cline->cmd_count; i++) {
-        waitpid(-1, &status, 0); 
-        if (WIFEXITED(status)) {
-            int exit_code = WEXITSTATUS(status);
-//            printf("Command %zu ('%s') exited with code %d\n", i, cline->cmds[i].argv[0], exit_code);
-        }
+    if (prev_pipe_read != -1) {
+        close(prev_pipe_read);
     }
+    return job;
 }
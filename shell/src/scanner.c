@@ -0,0 +1,160 @@
+#include "common.h"
+#include "scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+typedef void (*ScanFn)(const char *block, ScanMasks *masks);
+
+static void   scanScalar(const char *block, ScanMasks *masks);
+static ScanFn pickScan(const char **name);
+
+static ScanFn      scan_fn   = NULL;
+static const char *scan_name = NULL;
+
+void ScanBlock(const char *block, ScanMasks *masks) {
+    assert(block);
+    assert(masks);
+
+    if (scan_fn == NULL) {
+        scan_fn = pickScan(&scan_name);
+    }
+    scan_fn(block, masks);
+}
+
+const char* ScanImplName() {
+    if (scan_fn == NULL) {
+        scan_fn = pickScan(&scan_name);
+    }
+    return scan_name;
+}
+
+static void scanScalar(const char *block, ScanMasks *masks) {
+    uint64_t space = 0, pipe = 0, quote = 0, redir = 0;
+
+    for (unsigned i = 0; i < SCAN_BLOCK; i++) {
+        uint64_t bit = 1ULL << i;
+        switch (block[i]) {
+            case ' ': case '\t': case '\n':   space |= bit; break;
+            case '|':                         pipe  |= bit; break;
+            case '\'': case '"': case '\\':   quote |= bit; break;
+            case '<': case '>':               redir |= bit; break;
+            default:                                        break;
+        }
+    }
+
+    masks->space = space;
+    masks->pipe  = pipe;
+    masks->quote = quote;
+    masks->redir = redir;
+}
+
+#if SCAN_X86
+
+static void scanSse2(const char *block, ScanMasks *masks) __attribute__((target("sse2")));
+static void scanAvx2(const char *block, ScanMasks *masks) __attribute__((target("avx2")));
+
+static void scanSse2(const char *block, ScanMasks *masks) {
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tb = _mm_set1_epi8('\t');
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i pp = _mm_set1_epi8('|');
+    const __m128i sq = _mm_set1_epi8('\'');
+    const __m128i dq = _mm_set1_epi8('"');
+    const __m128i bs = _mm_set1_epi8('\\');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+
+    uint64_t space = 0, pipe = 0, quote = 0, redir = 0;
+
+    for (unsigned i = 0; i < SCAN_BLOCK; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(const void*)(block + i));
+
+        __m128i s = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tb)),
+                                 _mm_cmpeq_epi8(v, nl));
+        __m128i q = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sq), _mm_cmpeq_epi8(v, dq)),
+                                 _mm_cmpeq_epi8(v, bs));
+        __m128i r = _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt));
+
+        space |= (uint64_t)(uint32_t)_mm_movemask_epi8(s)                       << i;
+        pipe  |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, pp)) << i;
+        quote |= (uint64_t)(uint32_t)_mm_movemask_epi8(q)                       << i;
+        redir |= (uint64_t)(uint32_t)_mm_movemask_epi8(r)                       << i;
+    }
+
+    masks->space = space;
+    masks->pipe  = pipe;
+    masks->quote = quote;
+    masks->redir = redir;
+}
+
+static void scanAvx2(const char *block, ScanMasks *masks) {
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i tb = _mm256_set1_epi8('\t');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i pp = _mm256_set1_epi8('|');
+    const __m256i sq = _mm256_set1_epi8('\'');
+    const __m256i dq = _mm256_set1_epi8('"');
+    const __m256i bs = _mm256_set1_epi8('\\');
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+
+    uint64_t space = 0, pipe = 0, quote = 0, redir = 0;
+
+    for (unsigned i = 0; i < SCAN_BLOCK; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(const void*)(block + i));
+
+        __m256i s = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tb)),
+                                    _mm256_cmpeq_epi8(v, nl));
+        __m256i q = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sq), _mm256_cmpeq_epi8(v, dq)),
+                                    _mm256_cmpeq_epi8(v, bs));
+        __m256i r = _mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, gt));
+
+        space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s)                          << i;
+        pipe  |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pp)) << i;
+        quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(q)                          << i;
+        redir |= (uint64_t)(uint32_t)_mm256_movemask_epi8(r)                          << i;
+    }
+
+    masks->space = space;
+    masks->pipe  = pipe;
+    masks->quote = quote;
+    masks->redir = redir;
+}
+
+#endif // SCAN_X86
+
+// SHELL_SCAN=scalar|sse2|avx2 overrides the CPU-based choice, e.g. to compare outputs.
+static ScanFn pickScan(const char **name) {
+    const char *force = getenv("SHELL_SCAN");
+
+#if SCAN_X86
+    __builtin_cpu_init();
+    int has_avx2 = __builtin_cpu_supports("avx2");
+    int has_sse2 = __builtin_cpu_supports("sse2");
+
+    if (force != NULL && strcmp(force, "sse2") == 0 && has_sse2) {
+        *name = "sse2";
+        return scanSse2;
+    }
+    if (force == NULL || strcmp(force, "avx2") == 0) {
+        if (has_avx2) {
+            *name = "avx2";
+            return scanAvx2;
+        }
+        if (has_sse2) {
+            *name = "sse2";
+            return scanSse2;
+        }
+    }
+#else
+    (void)force;
+#endif
+
+    *name = "scalar";
+    return scanScalar;
+}
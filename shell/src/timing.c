@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+
+#include "common.h"
+#include "timing.h"
+
+#include <stdint.h>
+#include <sys/time.h>
+
+typedef struct {
+    uint64_t real_us;
+    uint64_t user_us;
+    uint64_t sys_us;
+    long     maxrss_kb;
+    long     nvcsw;
+    long     nivcsw;
+} Totals;
+
+static uint64_t tsDiffUs   (const struct timespec *from, const struct timespec *to);
+static uint64_t tvUs       (const struct timeval *tv);
+static Totals   stageTotals(const StageTiming *stage);
+static Totals   lineTotals (const StageTiming *stages, size_t count);
+static void     printJsonString(FILE *out, const char *str);
+static void     printJsonTotals(FILE *out, const Totals *t);
+
+void TimingNow(struct timespec *ts) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+// For builtins run inside the shell: usage is the difference of two RUSAGE_SELF samples.
+void TimingSelfDelta(const struct rusage *before, struct rusage *delta) {
+    struct rusage now;
+    getrusage(RUSAGE_SELF, &now);
+
+    *delta = now;
+    timersub(&now.ru_utime, &before->ru_utime, &delta->ru_utime);
+    timersub(&now.ru_stime, &before->ru_stime, &delta->ru_stime);
+    delta->ru_nvcsw  = now.ru_nvcsw  - before->ru_nvcsw;
+    delta->ru_nivcsw = now.ru_nivcsw - before->ru_nivcsw;
+}
+
+static uint64_t tsDiffUs(const struct timespec *from, const struct timespec *to) {
+    int64_t ns = (int64_t)(to->tv_sec - from->tv_sec) * 1000000000LL + (to->tv_nsec - from->tv_nsec);
+    return ns > 0 ? (uint64_t)ns / 1000 : 0;
+}
+
+static uint64_t tvUs(const struct timeval *tv) {
+    return (uint64_t)tv->tv_sec * 1000000ULL + (uint64_t)tv->tv_usec;
+}
+
+static Totals stageTotals(const StageTiming *stage) {
+    Totals t = {
+        .real_us   = tsDiffUs(&stage->start, &stage->end),
+        .user_us   = tvUs(&stage->usage.ru_utime),
+        .sys_us    = tvUs(&stage->usage.ru_stime),
+        .maxrss_kb = stage->usage.ru_maxrss,
+        .nvcsw     = stage->usage.ru_nvcsw,
+        .nivcsw    = stage->usage.ru_nivcsw,
+    };
+    return t;
+}
+
+// Wall time of the pipeline runs from the first start to the last exit
+static Totals lineTotals(const StageTiming *stages, size_t count) {
+    Totals total = {0, 0, 0, 0, 0, 0};
+    if (count == 0) {
+        return total;
+    }
+
+    const struct timespec *first = &stages[0].start;
+    const struct timespec *last  = &stages[0].end;
+
+    for (size_t i = 0; i < count; i++) {
+        Totals t = stageTotals(&stages[i]);
+        total.user_us += t.user_us;
+        total.sys_us  += t.sys_us;
+        total.nvcsw   += t.nvcsw;
+        total.nivcsw  += t.nivcsw;
+        if (t.maxrss_kb > total.maxrss_kb) {
+            total.maxrss_kb = t.maxrss_kb;
+        }
+        if (tsDiffUs(&stages[i].end, last) == 0) {
+            last = &stages[i].end;
+        }
+        if (tsDiffUs(first, &stages[i].start) == 0) {
+            first = &stages[i].start;
+        }
+    }
+    total.real_us = tsDiffUs(first, last);
+    return total;
+}
+
+void PrintTiming(FILE *out, const StageTiming *stages, size_t count) {
+    assert(out);
+    assert(stages);
+
+    for (size_t i = 0; i <= count; i++) {
+        Totals t = i < count ? stageTotals(&stages[i]) : lineTotals(stages, count);
+        char label[32];
+
+        if (i < count) {
+            snprintf(label, sizeof(label), "%zu %s", i, stages[i].name);
+        }
+        else {
+            snprintf(label, sizeof(label), "total");
+        }
+
+        fprintf(out, "[time] %-20s real %llu.%06llus  user %llu.%06llus  sys %llu.%06llus  "
+                     "maxrss %ldKB  csw %ld/%ld\n",
+                label,
+                (unsigned long long)(t.real_us / 1000000), (unsigned long long)(t.real_us % 1000000),
+                (unsigned long long)(t.user_us / 1000000), (unsigned long long)(t.user_us % 1000000),
+                (unsigned long long)(t.sys_us  / 1000000), (unsigned long long)(t.sys_us  % 1000000),
+                t.maxrss_kb, t.nvcsw, t.nivcsw);
+    }
+    fflush(out);
+}
+
+static void printJsonString(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char*)str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        }
+        else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        }
+        else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void printJsonTotals(FILE *out, const Totals *t) {
+    fprintf(out, "\"real_us\":%llu,\"user_us\":%llu,\"sys_us\":%llu,\"maxrss_kb\":%ld,"
+                 "\"nvcsw\":%ld,\"nivcsw\":%ld",
+            (unsigned long long)t->real_us, (unsigned long long)t->user_us,
+            (unsigned long long)t->sys_us, t->maxrss_kb, t->nvcsw, t->nivcsw);
+}
+
+// One JSON object per pipeline on a single line, for log collectors
+void PrintTimingRecord(FILE *out, const StageTiming *stages, size_t count) {
+    assert(out);
+    assert(stages);
+
+    fputs("{\"stages\":[", out);
+    for (size_t i = 0; i < count; i++) {
+        Totals t = stageTotals(&stages[i]);
+
+        fputs(i > 0 ? ",{\"cmd\":" : "{\"cmd\":", out);
+        printJsonString(out, stages[i].name);
+        fprintf(out, ",\"pid\":%d,\"status\":%d,", (int)stages[i].pid, stages[i].status);
+        printJsonTotals(out, &t);
+        fputc('}', out);
+    }
+
+    Totals total = lineTotals(stages, count);
+    fputs("],\"total\":{", out);
+    printJsonTotals(out, &total);
+    fputs("}}\n", out);
+    fflush(out);
+}
@@ -0,0 +1,442 @@
+#include "common.h"
+#include "variables.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define INITIAL_VARS 128
+#define TOMBSTONE    ((Var*)(uintptr_t)1)
+
+typedef struct {
+    char     *pair;       // "NAME=value", exactly what goes into envp
+    size_t   name_len;
+    uint64_t hash;
+    int      exported;
+} Var;
+
+typedef struct {
+    Var      **table;     // NULL free, TOMBSTONE deleted
+    size_t   cap;
+    size_t   used;        // live entries and tombstones, for the load factor
+    size_t   count;
+    char     **envp;      // snapshot of the exported pairs, NULL-terminated
+    int      envp_dirty;
+    uint64_t path_gen;    // bumped whenever $PATH changes, so the path cache need not compare it
+    int      status;      // $?
+    char     status_text[16];
+    char     pid_text[16];
+} VarTable;
+
+static VarTable vars = {NULL, 0, 0, 0, NULL, 1, 0, 0, "0", ""};
+
+static uint64_t hashName  (const char *name, size_t len);
+static Var**    findSlot  (const char *name, size_t len, uint64_t hash);
+static CmdError growTable ();
+static size_t   nameLength(const char *text);
+static const char* lookup (const char *name, size_t len);
+static int      isPath    (const char *name, size_t len);
+
+static uint64_t hashName(const char *name, size_t len) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// The live entry for name, or else the slot where it would go (reusing a tombstone)
+static Var** findSlot(const char *name, size_t len, uint64_t hash) {
+    Var  **free_slot = NULL;
+    size_t mask      = vars.cap - 1;
+
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        Var *v = vars.table[i];
+        if (v == NULL) {
+            return free_slot != NULL ? free_slot : &vars.table[i];
+        }
+        if (v == TOMBSTONE) {
+            if (free_slot == NULL) {
+                free_slot = &vars.table[i];
+            }
+            continue;
+        }
+        if (v->hash == hash && v->name_len == len && memcmp(v->pair, name, len) == 0) {
+            return &vars.table[i];
+        }
+    }
+}
+
+static CmdError growTable() {
+    size_t new_cap = vars.cap == 0 ? INITIAL_VARS : vars.cap * 2;
+    Var  **table   = (Var**)calloc(new_cap, sizeof(Var*));
+    if (table == NULL) {
+        return ALLOC_ERR;
+    }
+
+    for (size_t i = 0; i < vars.cap; i++) {
+        Var *v = vars.table[i];
+        if (v == NULL || v == TOMBSTONE) {
+            continue;
+        }
+        size_t j = v->hash & (new_cap - 1);
+        while (table[j] != NULL) {
+            j = (j + 1) & (new_cap - 1);
+        }
+        table[j] = v;
+    }
+
+    free(vars.table);
+    vars.table = table;
+    vars.cap   = new_cap;
+    vars.used  = vars.count;   // tombstones are gone
+    return OK;
+}
+
+// Length of the longest valid variable name at the start of text
+static size_t nameLength(const char *text) {
+    if (!isalpha((unsigned char)text[0]) && text[0] != '_') {
+        return 0;
+    }
+    size_t len = 1;
+    while (isalnum((unsigned char)text[len]) || text[len] == '_') {
+        len++;
+    }
+    return len;
+}
+
+CmdError VarsInit(char **envp) {
+    snprintf(vars.pid_text, sizeof(vars.pid_text), "%d", (int)getpid());
+
+    for (size_t i = 0; envp != NULL && envp[i] != NULL; i++) {
+        const char *eq = strchr(envp[i], '=');
+        if (eq == NULL || eq == envp[i]) {
+            continue;
+        }
+        CmdError err = VarSet(envp[i], (size_t)(eq - envp[i]), eq + 1, 1);
+        if (err != OK) {
+            return err;
+        }
+    }
+    return OK;
+}
+
+void VarsFree() {
+    for (size_t i = 0; i < vars.cap; i++) {
+        if (vars.table[i] != NULL && vars.table[i] != TOMBSTONE) {
+            free(vars.table[i]->pair);
+            free(vars.table[i]);
+        }
+    }
+    free(vars.table);
+    free(vars.envp);
+    vars.table      = NULL;
+    vars.cap        = 0;
+    vars.used       = 0;
+    vars.count      = 0;
+    vars.envp       = NULL;
+    vars.envp_dirty = 1;
+    vars.path_gen++;
+}
+
+static int isPath(const char *name, size_t len) {
+    return len == 4 && memcmp(name, "PATH", 4) == 0;
+}
+
+static const char* lookup(const char *name, size_t len) {
+    if (len == 1 && name[0] == '?') {
+        return vars.status_text;
+    }
+    if (len == 1 && name[0] == '$') {
+        return vars.pid_text;
+    }
+    if (vars.cap == 0) {
+        return NULL;
+    }
+
+    Var *v = *findSlot(name, len, hashName(name, len));
+    return v != NULL && v != TOMBSTONE ? v->pair + v->name_len + 1 : NULL;
+}
+
+const char* VarGet(const char *name) {
+    assert(name);
+
+    return lookup(name, strlen(name));
+}
+
+uint64_t VarsPathGeneration() {
+    return vars.path_gen;
+}
+
+CmdError VarSet(const char *name, size_t name_len, const char *value, int exported) {
+    assert(name);
+    assert(value);
+
+    if ((vars.used + 1) * 2 > vars.cap && growTable() != OK) {
+        return ALLOC_ERR;
+    }
+
+    size_t value_len = strlen(value);
+    char  *pair      = (char*)malloc(name_len + value_len + 2);
+    if (pair == NULL) {
+        return ALLOC_ERR;
+    }
+    memcpy(pair, name, name_len);
+    pair[name_len] = '=';
+    memcpy(pair + name_len + 1, value, value_len + 1);
+
+    uint64_t hash = hashName(name, name_len);
+    Var    **slot = findSlot(name, name_len, hash);
+    Var     *v    = *slot;
+
+    if (v == NULL || v == TOMBSTONE) {
+        Var *fresh = (Var*)calloc(1, sizeof(Var));
+        if (fresh == NULL) {
+            free(pair);
+            return ALLOC_ERR;
+        }
+        fresh->name_len = name_len;
+        fresh->hash     = hash;
+        vars.used      += v == NULL ? 1 : 0;
+        vars.count++;
+        *slot = v = fresh;
+    }
+    else {
+        free(v->pair);
+    }
+
+    int was_exported = v->exported;
+    v->pair     = pair;
+    v->exported = exported == VAR_KEEP_EXPORT ? v->exported : exported;
+    if (v->exported || was_exported) {
+        vars.envp_dirty = 1;
+    }
+    if (isPath(name, name_len)) {
+        vars.path_gen++;
+    }
+    return OK;
+}
+
+void VarUnset(const char *name) {
+    assert(name);
+
+    size_t len = strlen(name);
+    if (vars.cap == 0) {
+        return;
+    }
+
+    Var **slot = findSlot(name, len, hashName(name, len));
+    Var  *v    = *slot;
+    if (v == NULL || v == TOMBSTONE) {
+        return;
+    }
+    if (v->exported) {
+        vars.envp_dirty = 1;
+    }
+    if (isPath(name, len)) {
+        vars.path_gen++;
+    }
+    free(v->pair);
+    free(v);
+    *slot = TOMBSTONE;
+    vars.count--;
+}
+
+void VarsSetStatus(int status) {
+    vars.status = status;
+    snprintf(vars.status_text, sizeof(vars.status_text), "%d", status);
+}
+
+int VarIsAssignment(const char *word) {
+    size_t len = nameLength(word);
+    return len > 0 && word[len] == '=';
+}
+
+// p is at a '$'. *used is how many bytes the reference takes ($NAME, ${NAME}, $? or $$),
+// 0 if the '$' starts none of them and is just a character; an unset name gives "".
+CmdError VarsRef(const char *p, size_t *used, const char **value) {
+    assert(p);
+    assert(used);
+    assert(value);
+
+    const char *name  = p + 1;
+    int         brace = *name == '{';
+    name += brace;
+
+    size_t len = (*name == '?' || *name == '$') ? 1 : nameLength(name);
+    if (len == 0 || (brace && name[len] != '}')) {
+        *used  = 0;
+        *value = NULL;
+        return brace ? SYNTAX_ERR : OK;   // '${' without a name and '}'
+    }
+
+    *value = lookup(name, len);
+    if (*value == NULL) {
+        *value = "";
+    }
+    *used = (size_t)(name + len + (size_t)brace - p);
+    return OK;
+}
+
+// Every reference in word is replaced, quotes mean nothing here (a heredoc body).
+// The result is in the arena.
+CmdError VarsExpand(Arena *arena, const char *word, char **out) {
+    assert(arena);
+    assert(word);
+    assert(out);
+
+    // Two passes: measure, then copy, so the arena gets one exact allocation
+    char *result = NULL;
+    size_t size  = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        size_t n = 0;
+        for (const char *p = word; *p != '\0'; ) {
+            const char *value = NULL;
+            size_t      used  = 0;
+            if (*p == '$') {
+                CmdError err = VarsRef(p, &used, &value);
+                if (err != OK) {
+                    return err;
+                }
+            }
+            if (used == 0) {
+                if (result != NULL) {
+                    result[n] = *p;
+                }
+                n++;
+                p++;
+                continue;
+            }
+
+            size_t vlen = strlen(value);
+            if (result != NULL) {
+                memcpy(result + n, value, vlen);
+            }
+            n += vlen;
+            p += used;
+        }
+
+        if (result == NULL) {
+            size   = n;
+            result = (char*)ArenaAlloc(arena, size + 1, 1);
+            if (result == NULL) {
+                return ALLOC_ERR;
+            }
+        }
+    }
+
+    result[size] = '\0';
+    *out = result;
+    return OK;
+}
+
+// The shared snapshot: unchanged exports mean the same array, with no copying at all
+char** VarsEnviron() {
+    if (!vars.envp_dirty && vars.envp != NULL) {
+        return vars.envp;
+    }
+
+    char **envp = (char**)malloc((vars.count + 1) * sizeof(char*));
+    if (envp == NULL) {
+        // The old snapshot may point at pairs VarSet()/VarUnset() have freed since
+        free(vars.envp);
+        vars.envp = NULL;
+        return NULL;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < vars.cap; i++) {
+        Var *v = vars.table[i];
+        if (v != NULL && v != TOMBSTONE && v->exported) {
+            envp[n++] = v->pair;
+        }
+    }
+    envp[n] = NULL;
+
+    free(vars.envp);
+    vars.envp       = envp;
+    vars.envp_dirty = 0;
+    return envp;
+}
+
+// 'NAME=value cmd': the snapshot's pointers with the assignments laid over them.
+// Only the pointer array is new; the caller frees it after the launch.
+char** VarsEnvironWith(char **assigns, size_t count) {
+    char **base = VarsEnviron();
+    if (base == NULL) {
+        return NULL;
+    }
+
+    size_t n = 0;
+    while (base[n] != NULL) {
+        n++;
+    }
+
+    char **envp = (char**)malloc((n + count + 1) * sizeof(char*));
+    if (envp == NULL) {
+        return NULL;
+    }
+
+    size_t out = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len      = (size_t)(strchr(base[i], '=') - base[i]);
+        int    replaced = 0;
+        for (size_t j = 0; j < count && !replaced; j++) {
+            replaced = strncmp(assigns[j], base[i], len + 1) == 0;
+        }
+        if (!replaced) {
+            envp[out++] = base[i];
+        }
+    }
+    for (size_t j = 0; j < count; j++) {
+        envp[out++] = assigns[j];
+    }
+    envp[out] = NULL;
+    return envp;
+}
+
+void VarsApply(char **assigns, size_t count, int exported) {
+    for (size_t i = 0; i < count; i++) {
+        const char *eq = strchr(assigns[i], '=');
+        VarSet(assigns[i], (size_t)(eq - assigns[i]), eq + 1, exported);
+    }
+}
+
+// export [NAME[=value]...]; without arguments lists the environment
+int ExportBuiltin(Command *cmd) {
+    assert(cmd);
+
+    if (cmd->argc == 1) {
+        for (char **env = VarsEnviron(); env != NULL && *env != NULL; env++) {
+            printf("export %s\n", *env);
+        }
+        return 0;
+    }
+
+    int rc = 0;
+    for (size_t i = 1; i < cmd->argc; i++) {
+        const char *arg = cmd->argv[i];
+        size_t      len = nameLength(arg);
+        if (len == 0 || (arg[len] != '\0' && arg[len] != '=')) {
+            fprintf(stderr, "shell: export: '%s': not a valid identifier\n", arg);
+            rc = 1;
+            continue;
+        }
+
+        const char *value = arg[len] == '=' ? arg + len + 1 : lookup(arg, len);
+        if (VarSet(arg, len, value != NULL ? value : "", 1) != OK) {
+            rc = 1;
+        }
+    }
+    return rc;
+}
+
+int UnsetBuiltin(Command *cmd) {
+    assert(cmd);
+
+    for (size_t i = 1; i < cmd->argc; i++) {
+        VarUnset(cmd->argv[i]);
+    }
+    return 0;
+}